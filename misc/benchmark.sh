@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# prints stage timings of raven for increasing number of threads
+# usage: benchmark.sh <raven> <sequences> <threads>[,<threads>...] [<options>]
+# (synthetic sequences can be created with misc/simulator.py)
+
+set -e
+
+if [[ $# -lt 3 ]]; then
+  echo "usage: $0 <raven> <sequences> <threads>[,<threads>...] [<options>]" >&2
+  exit 1
+fi
+
+raven=$(realpath $1)
+sequences=$(realpath $2)
+threads=$3
+shift 3
+
+work=$(mktemp -d)
+trap 'rm -rf ${work}' EXIT
+cd ${work}
+
+for t in ${threads//,/ }; do
+  rm -f raven.cereal
+  ${raven} -t ${t} -p 0 "$@" ${sequences} 2> log > /dev/null
+  echo "# ${t} thread(s)"
+  grep "Graph::Assemble\]" log | grep -v checkpoint |
+    sed -E 's/^\[raven::Graph::Assemble\] //'
+done
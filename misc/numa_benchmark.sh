@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# compares stage timings of raven with and without --numa
+# usage: numa_benchmark.sh <raven> <sequences> <threads> [<repeats>]
+
+set -e
+
+raven=$(realpath $1)
+sequences=$(realpath $2)
+threads=$3
+repeats=${4:-3}
+
+if [[ -z ${raven} || -z ${sequences} || -z ${threads} ]]; then
+  echo "usage: $0 <raven> <sequences> <threads> [<repeats>]" >&2
+  exit 1
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf ${work}' EXIT
+cd ${work}
+
+for mode in "" "--numa"; do
+  for ((i = 0; i < repeats; ++i)); do
+    rm -f raven.cereal
+    ${raven} -t ${threads} -p 0 ${mode} ${sequences} 2> log > /dev/null
+    echo "# ${mode:-default} run ${i}"
+    grep -E "\] (minimized|mapped|reached|bound)" log |
+      sed -E 's/^\[raven::([A-Za-z:]*)\] //'
+  done
+done
@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+import sys, argparse, random
+
+class Simulator:
+  def __init__(self, genome_length, coverage, repeat_length, divergence, seed):
+    self.genome_length = genome_length
+    self.coverage = coverage
+    self.repeat_length = repeat_length
+    self.divergence = divergence
+    self.random = random.Random(seed)
+
+  def Random(self, length):
+    return "".join(self.random.choice("ACGT") for _ in range(length))
+
+  def Mutate(self, data, rate):
+    data = list(data)
+    for i in range(len(data)):
+      if self.random.random() < rate:
+        data[i] = self.random.choice("ACGT")
+    return "".join(data)
+
+  def ReverseComplement(self, data):
+    complement = { "A": "T", "C": "G", "G": "C", "T": "A" }
+    return "".join(complement[c] for c in reversed(data))
+
+  def CreateHaplotypes(self):
+    # unique segments separated by copies of one repeat, second haplotype
+    # diverges in the middle third of the genome
+    repeat = self.Random(self.repeat_length)
+    unique_length = max(self.genome_length // 8 - self.repeat_length, 1000)
+    parts = []
+    while sum(len(it) for it in parts) < self.genome_length:
+      parts.append(self.Random(unique_length))
+      parts.append(self.Mutate(repeat, 0.001))
+    lhs = "".join(parts)[:self.genome_length]
+    begin, end = len(lhs) // 3, 2 * len(lhs) // 3
+    rhs = lhs[:begin] + self.Mutate(lhs[begin:end], self.divergence) + lhs[end:]
+    return [lhs, rhs]
+
+  def Run(self):
+    haplotypes = self.CreateHaplotypes()
+    num_reads = int(self.genome_length * self.coverage / 12000)
+    for i in range(num_reads):
+      genome = haplotypes[self.random.randint(0, len(haplotypes) - 1)]
+      length = min(self.random.randint(4000, 20000), len(genome))
+      begin = self.random.randint(0, len(genome) - length)
+      data = self.Mutate(genome[begin:begin + length], 0.01)
+      if self.random.random() < 0.02:  # chimera
+        other = self.random.randint(0, len(genome) - length)
+        data = data[:length // 2] + genome[other:other + length // 2]
+      if self.random.random() < 0.5:
+        data = self.ReverseComplement(data)
+      quality = "".join(chr(33 + self.random.randint(5, 30)) for _ in data)
+      sys.stdout.write("@read{}\n{}\n+\n{}\n".format(i, data, quality))
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(
+      description = "Simulator creates noisy reads of a diploid genome with repeats for benchmarking",
+      formatter_class = argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument("-g", "--genome-length", type = int, default = 1000000,
+      help = "length of each haplotype")
+  parser.add_argument("-c", "--coverage", type = float, default = 40,
+      help = "total sequencing depth")
+  parser.add_argument("-r", "--repeat-length", type = int, default = 9000,
+      help = "length of the interspersed repeat")
+  parser.add_argument("-d", "--divergence", type = float, default = 0.03,
+      help = "substitution rate between haplotypes")
+  parser.add_argument("-s", "--seed", type = int, default = 42,
+      help = "seed of the random number generator")
+
+  args = parser.parse_args()
+  simulator = Simulator(args.genome_length, args.coverage, args.repeat_length,
+      args.divergence, args.seed)
+  simulator.Run()
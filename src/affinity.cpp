@@ -0,0 +1,90 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "affinity.hpp"
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#ifdef NUMA_ENABLED
+#include <numa.h>
+#endif
+
+namespace raven {
+
+void RunOnEachThread(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    const std::function<void(std::uint32_t)>& task) {
+
+  // block workers until all tasks are picked up so that each runs on its own
+  std::uint32_t num_threads = thread_pool->num_threads();
+  std::uint32_t num_arrived = 0;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  std::vector<std::future<void>> thread_futures;
+  for (std::uint32_t i = 0; i < num_threads; ++i) {
+    thread_futures.emplace_back(thread_pool->Submit(
+        [&] (std::uint32_t i) -> void {
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (++num_arrived == num_threads) {
+              condition.notify_all();
+            } else {
+              condition.wait(lock, [&] () -> bool {
+                return num_arrived == num_threads;
+              });
+            }
+          }
+          task(i);
+        },
+        i));
+  }
+  for (const auto& it : thread_futures) {
+    it.wait();
+  }
+}
+
+std::uint32_t BindToNodes(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool) {
+#ifdef NUMA_ENABLED
+  if (numa_available() < 0) {
+    return 1;
+  }
+  std::uint32_t num_nodes = numa_num_configured_nodes();
+  std::uint32_t num_threads = thread_pool->num_threads();
+  RunOnEachThread(thread_pool, [&] (std::uint32_t i) -> void {
+    numa_run_on_node(i * num_nodes / num_threads);
+    numa_set_localalloc();
+  });
+  return num_nodes;
+#else
+  (void) thread_pool;
+  return 1;
+#endif
+}
+
+void InterleaveMemory(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    bool interleave) {
+#ifdef NUMA_ENABLED
+  if (numa_available() < 0) {
+    return;
+  }
+  auto set_policy = [&] (std::uint32_t) -> void {
+    if (interleave) {
+      numa_set_interleave_mask(numa_all_nodes_ptr);
+    } else {
+      numa_set_localalloc();
+    }
+  };
+  RunOnEachThread(thread_pool, set_policy);
+  set_policy(0);
+#else
+  (void) thread_pool;
+  (void) interleave;
+#endif
+}
+
+}  // namespace raven
@@ -0,0 +1,32 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAVEN_AFFINITY_HPP_
+#define RAVEN_AFFINITY_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "thread_pool/thread_pool.hpp"
+
+namespace raven {
+
+// run task once on each worker of the pool (pool has to be idle)
+void RunOnEachThread(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    const std::function<void(std::uint32_t)>& task);
+
+// pin workers to NUMA nodes in contiguous blocks and make them allocate
+// memory locally, returns number of nodes (no-op without NUMA support)
+std::uint32_t BindToNodes(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool);
+
+// interleave pages allocated by workers and the calling thread across NUMA
+// nodes, or switch back to local allocation
+void InterleaveMemory(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    bool interleave);
+
+}  // namespace raven
+
+#endif  // RAVEN_AFFINITY_HPP_
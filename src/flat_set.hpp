@@ -0,0 +1,110 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAVEN_FLAT_SET_HPP_
+#define RAVEN_FLAT_SET_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace raven {
+
+// sorted set of unique values kept inline up to N values and on the heap
+// afterwards, meant for many small sets (the default holds the transitive
+// neighbours of most nodes, measured sets mostly hold 8 - 16 values)
+template<class T, std::uint32_t N = 16>
+class FlatSet {
+ public:
+  FlatSet()
+      : size_(0),
+        small_(),
+        large_() {}
+
+  FlatSet(const FlatSet&) = default;
+  FlatSet& operator=(const FlatSet&) = default;
+
+  FlatSet(FlatSet&&) = default;
+  FlatSet& operator=(FlatSet&&) = default;
+
+  ~FlatSet() = default;
+
+  const T* begin() const {
+    return size_ > N ? large_.data() : small_;
+  }
+  const T* end() const {
+    return begin() + size_;
+  }
+
+  std::uint32_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::uint32_t count(const T& value) const {
+    return std::binary_search(begin(), end(), value);
+  }
+
+  // returns false if value is already present
+  bool emplace(const T& value) {
+    auto it = std::lower_bound(begin(), end(), value);
+    if (it != end() && *it == value) {
+      return false;
+    }
+    std::uint32_t i = it - begin();
+    if (size_ < N) {
+      std::copy_backward(small_ + i, small_ + size_, small_ + size_ + 1);
+      small_[i] = value;
+    } else {
+      if (size_ == N) {  // move to heap
+        large_.assign(small_, small_ + N);
+      }
+      large_.insert(large_.begin() + i, value);
+    }
+    ++size_;
+    return true;
+  }
+
+  template<class Iterator>
+  void insert(Iterator first, Iterator last) {
+    for (; first != last; ++first) {
+      emplace(*first);
+    }
+  }
+
+  void clear() {
+    size_ = 0;
+    std::vector<T>().swap(large_);
+  }
+
+  void swap(FlatSet& other) {
+    std::swap(size_, other.size_);
+    std::swap(small_, other.small_);
+    large_.swap(other.large_);
+  }
+
+  template<class Archive>
+  void save(Archive& archive) const {  // NOLINT
+    std::vector<T> values(begin(), end());
+    archive(values);
+  }
+
+  template<class Archive>
+  void load(Archive& archive) {  // NOLINT
+    std::vector<T> values;
+    archive(values);
+    clear();
+    insert(values.begin(), values.end());
+  }
+
+ private:
+  std::uint32_t size_;
+  T small_[N];
+  std::vector<T> large_;
+};
+
+}  // namespace raven
+
+#endif  // RAVEN_FLAT_SET_HPP_
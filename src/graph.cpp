@@ -3,86 +3,164 @@
 #include "graph.hpp"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <deque>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <numeric>
 #include <random>
 #include <stdexcept>
+#include <unordered_map>
 
 #include "biosoup/timer.hpp"
 #include "cereal/archives/binary.hpp"
 #include "cereal/archives/json.hpp"
 #include "racon/polisher.hpp"
 
+#include "affinity.hpp"
+#include "homopolymer.hpp"
+#include "quality.hpp"
+
 namespace raven {
 
-Graph::Node::Node(const biosoup::Sequence& sequence)
-    : id(num_objects++),
+constexpr std::uint32_t kNil = std::numeric_limits<std::uint32_t>::max();
+constexpr std::uint32_t kNodeBatchSize = 1U << 12;  // per thread task
+// leads archives, older checkpoints begin with a small stage number instead
+constexpr std::uint32_t kArchiveVersion = 0x52560001;
+
+Graph::Node::Node(std::uint32_t id, const biosoup::Sequence& sequence)
+    : id(id),
       name(sequence.name),
       data(sequence.data),
       count(1),
       is_circular(),
       is_polished(),
+      is_removed(),
       transitive(),
+      pair(),
       inedges(),
-      outedges(),
-      pair() {}
+      outedges() {}
 
-Graph::Node::Node(Node* begin, Node* end)
-    : id(num_objects++),
+Graph::Node::Node(std::uint32_t id, bool is_circular)
+    : id(id),
       name(),
       data(),
       count(),
-      is_circular(begin == end),
+      is_circular(is_circular),
       is_polished(),
+      is_removed(),
       transitive(),
+      pair(),
       inedges(),
-      outedges(),
-      pair() {
+      outedges() {}
+
+Graph::Edge::Edge(
+    std::uint32_t id,
+    std::uint32_t tail,
+    std::uint32_t head,
+    std::uint32_t length)
+    : id(id),
+      length(length),
+      weight(0),
+      is_removed(),
+      tail(tail),
+      head(head),
+      pair() {}
 
-  auto it = begin;
-  while (true) {
-    data += it->outedges.front()->Label();
-    count += it->count;
-    if ((it = it->outedges.front()->head) == end) {
-      break;
+Graph::Worklist::Worklist(std::uint32_t num_nodes)
+    : is_running_(false),
+      position_(0),
+      is_pending_(num_nodes, 1),
+      pending_(num_nodes),
+      is_current_(num_nodes, 0),
+      watchers_(num_nodes),
+      current_() {
+  std::iota(pending_.begin(), pending_.end(), 0);
+}
+
+void Graph::Worklist::Start() {
+  for (auto it : pending_) {
+    is_pending_[it] = 0;
+    if (!is_current_[it]) {
+      is_current_[it] = 1;
+      current_.emplace(it);
     }
   }
-  if (begin != end) {
-    data += end->data;
-    count += end->count;
+  std::vector<std::uint32_t>().swap(pending_);
+  is_running_ = true;
+}
+
+bool Graph::Worklist::Next(std::uint32_t* i) {
+  if (current_.empty()) {
+    is_running_ = false;
+    return false;
   }
+  *i = position_ = current_.top();
+  current_.pop();
+  is_current_[*i] = 0;
+  return true;
+}
 
-  name = (is_unitig() ? "Utg" : "Ctg") + std::to_string(id);
+void Graph::Worklist::Push(std::uint32_t i) {
+  if (is_running_ && i > position_) {
+    if (!is_current_[i]) {
+      is_current_[i] = 1;
+      current_.emplace(i);
+    }
+  } else if (!is_pending_[i]) {
+    is_pending_[i] = 1;
+    pending_.emplace_back(i);
+  }
 }
 
-Graph::Edge::Edge(Node* tail, Node* head, std::uint32_t length)
-    : id(num_objects++),
-      length(length),
-      weight(0),
-      tail(tail),
-      head(head),
-      pair() {
-  tail->outedges.emplace_back(this);
-  head->inedges.emplace_back(this);
+void Graph::Worklist::Watch(
+    std::uint32_t i,
+    const std::vector<std::uint32_t>& nodes) {
+  for (auto it : nodes) {
+    watchers_[it].emplace_back(i);
+  }
 }
 
-std::atomic<std::uint32_t> Graph::Node::num_objects{0};
-std::atomic<std::uint32_t> Graph::Edge::num_objects{0};
+void Graph::Worklist::Notify(const std::vector<std::uint32_t>& nodes) {
+  for (auto it : nodes) {
+    Push(it);
+    for (auto jt : watchers_[it]) {
+      Push(jt);
+    }
+    std::vector<std::uint32_t>().swap(watchers_[it]);
+  }
+}
 
-Graph::Graph(std::shared_ptr<thread_pool::ThreadPool> thread_pool)
+Graph::Graph(std::shared_ptr<thread_pool::ThreadPool> thread_pool, bool numa)
     : thread_pool_(thread_pool ?
           thread_pool :
           std::make_shared<thread_pool::ThreadPool>(1)),
+      numa_(numa),
       minimizer_engine_(15, 5, thread_pool_),
       stage_(-5),
       piles_(),
       nodes_(),
-      edges_() {}
+      edges_(),
+      adjacency_(),
+      adjacency_slack_(0),
+      path_similarities_() {}
+
+void Graph::Construct(
+    std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,  // NOLINT
+    bool hpc,
+    MinimizerParameters coarse,
+    MinimizerParameters sensitive,
+    double invalid_frequency,
+    bool tune,
+    double coverage,
+    std::uint32_t num_shards,
+    std::int32_t shard) {
 
-void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences) {  // NOLINT
   if (sequences.empty() || stage_ > -4) {
     return;
   }
@@ -257,29 +335,181 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
   };
   // biosoup::Overlap helper functions
 
-  if (stage_ == -5) {  // checkpoint test
+  bool is_shard = num_shards > 0 && shard >= 0;
+  bool is_merge = num_shards > 0 && shard < 0;
+
+  if (stage_ == -5 && !is_shard) {  // checkpoint test
     Store();
   }
 
   biosoup::Timer timer{};
 
+  // sequences used for minimization and mapping
+  HomopolymerCompressor compressor{};
+  std::vector<std::unique_ptr<biosoup::Sequence>> compressed;
+  auto& seeds = hpc ? compressed : sequences;
+  auto seeds_map = [&] (
+      std::uint32_t i,
+      bool avoid_symmetric,
+      bool minhash) -> std::vector<biosoup::Overlap> {
+    auto dst = minimizer_engine_.Map(seeds[i], true, avoid_symmetric, minhash);
+    if (hpc) {
+      for (auto& it : dst) {
+        compressor.Decompress(it);
+      }
+    }
+    return dst;
+  };
+  auto seeds_minimize = [&] (std::uint32_t first, std::uint32_t last) -> void {
+    if (numa_) {  // index is shared by all workers
+      InterleaveMemory(thread_pool_, true);
+    }
+    minimizer_engine_.Minimize(seeds.begin() + first, seeds.begin() + last);
+    if (numa_) {
+      InterleaveMemory(thread_pool_, false);
+    }
+  };
+
+  // compress and tune once before the first mapping, a merge run loads its
+  // overlaps from shards and needs neither until stage -4
+  bool is_prepared = false;
+  auto prepare = [&] () -> void {
+    if (is_prepared) {
+      return;
+    }
+    is_prepared = true;
+
+    if (hpc) {
+      timer.Start();
+
+      compressed = compressor.Compress(sequences, thread_pool_);
+
+      std::cerr << "[raven::Graph::Construct] compressed homopolymers "
+                << std::fixed << timer.Stop() << "s"
+                << std::endl;
+    }
+
+    if (tune) {
+      timer.Start();
+
+      auto kw = TuneMinimizers(seeds, coarse);
+      coarse.k = sensitive.k = kw.first;
+      coarse.w = sensitive.w = kw.second;
+
+      std::cerr << "[raven::Graph::Construct] tuned minimizers (k = "
+                << kw.first << ", w = " << kw.second << ") "
+                << std::fixed << timer.Stop() << "s"
+                << std::endl;
+    }
+  };
+  if (stage_ != -5 || !is_merge) {
+    prepare();
+  }
+
   if (stage_ == -5) {  // find overlaps and create piles
-    for (const auto& it : sequences) {
-      piles_.emplace_back(new Pile(it->id, it->data.size()));
+    minimizer_engine_ = ram::MinimizerEngine(coarse.k, coarse.w, thread_pool_);
+
+    // first touch of coverage arrays happens on workers
+    piles_.resize(sequences.size());
+    std::vector<std::future<void>> thread_futures;
+    for (std::uint32_t i = 0; i < sequences.size(); ++i) {
+      thread_futures.emplace_back(thread_pool_->Submit(
+          [&] (std::uint32_t i) -> void {
+            piles_[i].reset(
+                new Pile(sequences[i]->id, sequences[i]->data.size()));
+          },
+          i));
+    }
+    for (const auto& it : thread_futures) {
+      it.wait();
     }
-    for (std::uint32_t i = 0, j = 0, bytes = 0; i < sequences.size(); ++i) {
-      bytes += sequences[i]->data.size();
-      if (i != sequences.size() - 1 && bytes < (1U << 30)) {
+    thread_futures.clear();
+
+    std::uint32_t s = sequences.size();
+    std::vector<std::uint32_t> order;  // of seeds while some are dropped
+    if (coverage > 0) {  // drop shortest and least accurate sequences
+      timer.Start();
+
+      std::uint64_t genome_size = EstimateGenomeSize(sequences);
+      std::uint64_t num_bytes = 0;
+      for (const auto& it : sequences) {
+        num_bytes += it->data.size();
+      }
+
+      if (genome_size > 0 && num_bytes > coverage * genome_size) {
+        std::vector<std::pair<double, std::uint32_t>> scores;
+        for (const auto& it : sequences) {
+          double accuracy = 1;
+          if (!it->quality.empty()) {
+            double q = 0;
+            for (const auto& jt : it->quality) {
+              q += jt - 33;
+            }
+            accuracy -= std::pow(10, -q / it->quality.size() / 10);
+          }
+          scores.emplace_back(it->data.size() * accuracy, it->id);
+        }
+        std::sort(scores.begin(), scores.end(),
+            [] (const std::pair<double, std::uint32_t>& lhs,
+                const std::pair<double, std::uint32_t>& rhs) -> bool {
+              return lhs.first > rhs.first ||
+                  (lhs.first == rhs.first && lhs.second < rhs.second);
+            });
+
+        num_bytes = 0;
+        for (const auto& it : scores) {
+          if (num_bytes < coverage * genome_size) {
+            num_bytes += piles_[it.second]->length();
+          } else {
+            piles_[it.second]->set_is_dropped();
+            --s;
+          }
+        }
+
+        // kept seeds are moved to the front for minimization and mapping and
+        // put back in place afterwards
+        order.resize(seeds.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_partition(order.begin(), order.end(),
+            [&] (std::uint32_t i) -> bool {
+              return !piles_[seeds[i]->id]->is_dropped();
+            });
+        std::vector<std::unique_ptr<biosoup::Sequence>> tmp;
+        tmp.reserve(seeds.size());
+        for (auto it : order) {
+          tmp.emplace_back(std::move(seeds[it]));
+        }
+        seeds.swap(tmp);
+      }
+
+      std::cerr << "[raven::Graph::Construct] kept " << s << " sequences "
+                << "(genome size ~" << genome_size << ") "
+                << std::fixed << timer.Stop() << "s"
+                << std::endl;
+    }
+
+    std::uint32_t first = 0;
+    std::uint32_t last = is_merge ? 0 : s;
+    if (is_shard) {
+      std::vector<std::uint64_t> num_bytes(1, 0);
+      for (std::uint32_t i = 0; i < s; ++i) {
+        num_bytes.emplace_back(num_bytes.back() + seeds[i]->data.size());
+      }
+      first = ShardBoundary(num_bytes, shard, num_shards);
+      last = std::min(ShardBoundary(num_bytes, shard + 1, num_shards), s);
+    }
+
+    for (std::uint32_t i = first, j = first, bytes = 0; i < last; ++i) {
+      bytes += seeds[i]->data.size();
+      if (i != last - 1 && bytes < (1U << 30)) {
         continue;
       }
       bytes = 0;
 
       timer.Start();
 
-      minimizer_engine_.Minimize(
-          sequences.begin() + j,
-          sequences.begin() + i + 1);
-      minimizer_engine_.Filter(0.001);
+      seeds_minimize(j, i + 1);
+      minimizer_engine_.Filter(coarse.frequency);
 
       std::cerr << "[raven::Graph::Construct] minimized "
                 << j << " - " << i + 1 << " / " << sequences.size() << " "
@@ -298,11 +528,11 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
       for (std::uint32_t k = 0; k < i + 1; ++k) {
         thread_futures.emplace_back(thread_pool_->Submit(
             [&] (std::uint32_t i) -> std::vector<biosoup::Overlap> {
-              return minimizer_engine_.Map(sequences[i], true, true, true);
+              return seeds_map(i, true, true);
             },
             k));
 
-        bytes += sequences[k]->data.size();
+        bytes += seeds[k]->data.size();
         if (k != i && bytes < (1U << 30)) {
           continue;
         }
@@ -360,6 +590,58 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
 
       j = i + 1;
     }
+
+    if (!order.empty()) {
+      std::vector<std::unique_ptr<biosoup::Sequence>> tmp(seeds.size());
+      for (std::uint32_t i = 0; i < order.size(); ++i) {
+        tmp[order[i]] = std::move(seeds[i]);
+      }
+      seeds.swap(tmp);
+    }
+  }
+
+  if (stage_ == -5 && is_shard) {  // store partial piles and overlaps
+    timer.Start();
+
+    StoreShard(shard, overlaps);
+
+    std::cerr << "[raven::Graph::Construct] stored shard "
+              << shard + 1 << " / " << num_shards << " "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
+    return;
+  }
+
+  if (stage_ == -5 && is_merge) {  // merge partial piles and overlaps
+    timer.Start();
+
+    for (std::uint32_t i = 0; i < num_shards; ++i) {
+      LoadShard(i, overlaps);
+    }
+
+    std::vector<std::future<void>> thread_futures;
+    for (std::uint32_t i = 0; i < overlaps.size(); ++i) {
+      if (overlaps[i].size() <= 16) {
+        continue;
+      }
+      thread_futures.emplace_back(thread_pool_->Submit(
+          [&] (std::uint32_t i) -> void {
+            std::sort(overlaps[i].begin(), overlaps[i].end(),
+                [&] (const biosoup::Overlap& lhs,
+                     const biosoup::Overlap& rhs) -> bool {
+                  return overlap_length(lhs) > overlap_length(rhs);
+                });
+            overlaps[i].resize(16);
+          },
+          i));
+    }
+    for (const auto& it : thread_futures) {
+      it.wait();
+    }
+
+    std::cerr << "[raven::Graph::Construct] merged " << num_shards << " shards "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
   }
 
   if (stage_ == -5) {  // trim and annotate piles
@@ -528,24 +810,38 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
   }
 
   if (stage_ == -4) {  // find overlaps and update piles with repetitive regions
-    std::sort(sequences.begin(), sequences.end(),
+    prepare();
+
+    minimizer_engine_ = ram::MinimizerEngine(
+        sensitive.k,
+        sensitive.w,
+        thread_pool_);
+
+    // valid, invalid and dropped sequences
+    auto group = [&] (std::uint32_t i) -> std::uint32_t {
+      return piles_[i]->is_dropped() ? 2 : piles_[i]->is_invalid();
+    };
+    std::sort(seeds.begin(), seeds.end(),
         [&] (const std::unique_ptr<biosoup::Sequence>& lhs,
              const std::unique_ptr<biosoup::Sequence>& rhs) -> bool {
-          return piles_[lhs->id]->is_invalid() <  piles_[rhs->id]->is_invalid() ||  // NOLINT
-                (piles_[lhs->id]->is_invalid() == piles_[rhs->id]->is_invalid() && lhs->id < rhs->id);  // NOLINT
+          return group(lhs->id) <  group(rhs->id) ||
+                (group(lhs->id) == group(rhs->id) && lhs->id < rhs->id);
         });
 
-    std::uint32_t s = 0;
-    for (std::uint32_t i = 0; i < sequences.size(); ++i) {
-      if (piles_[sequences[i]->id]->is_invalid()) {
-        s = i;
-        break;
+    std::uint32_t s = seeds.size();
+    std::uint32_t t = seeds.size();
+    for (std::uint32_t i = seeds.size(); i > 0; --i) {
+      if (group(seeds[i - 1]->id) == 2) {
+        t = i - 1;
+      }
+      if (group(seeds[i - 1]->id) > 0) {
+        s = i - 1;
       }
     }
 
-    overlaps.resize(sequences.size() + 1);
+    overlaps.resize(seeds.size() + 1);
     for (std::uint32_t i = 0, j = 0, bytes = 0; i < s; ++i) {
-      bytes += sequences[i]->data.size();
+      bytes += seeds[i]->data.size();
       if (i != s - 1 && bytes < (1U << 30)) {
         continue;
       }
@@ -553,9 +849,7 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
 
       timer.Start();
 
-      minimizer_engine_.Minimize(
-          sequences.begin() + j,
-          sequences.begin() + i + 1);
+      seeds_minimize(j, i + 1);
 
       std::cerr << "[raven::Graph::Construct] minimized "
                 << j << " - " << i + 1 << " / " << s << " "
@@ -566,11 +860,11 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
 
       // map valid reads to each other
       std::vector<std::future<std::vector<biosoup::Overlap>>> thread_futures;
-      minimizer_engine_.Filter(0.001);
+      minimizer_engine_.Filter(sensitive.frequency);
       for (std::uint32_t k = 0; k < i + 1; ++k) {
         thread_futures.emplace_back(thread_pool_->Submit(
             [&] (std::uint32_t i) -> std::vector<biosoup::Overlap> {
-              return minimizer_engine_.Map(sequences[i], true, true);
+              return seeds_map(i, true, false);
             },
             k));
       }
@@ -608,16 +902,16 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
       timer.Start();
 
       // map invalid reads to valid reads
-      minimizer_engine_.Filter(0.00001);
-      for (std::uint32_t k = s; k < sequences.size(); ++k) {
+      minimizer_engine_.Filter(invalid_frequency);
+      for (std::uint32_t k = s; k < t; ++k) {
         thread_futures.emplace_back(thread_pool_->Submit(
             [&] (std::uint32_t i) -> std::vector<biosoup::Overlap> {
-              return minimizer_engine_.Map(sequences[i], true, false, true);
+              return seeds_map(i, false, true);
             },
             k));
 
-        bytes += sequences[k]->data.size();
-        if (k != sequences.size() - 1 && bytes < (1U << 30)) {
+        bytes += seeds[k]->data.size();
+        if (k != t - 1 && bytes < (1U << 30)) {
           continue;
         }
         bytes = 0;
@@ -631,7 +925,7 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
 
         std::vector<std::future<void>> void_futures;
         for (std::uint32_t k = j; k < i + 1; ++k) {
-          if (overlaps[sequences[k]->id].empty()) {
+          if (overlaps[seeds[k]->id].empty()) {
             continue;
           }
           void_futures.emplace_back(thread_pool_->Submit(
@@ -639,7 +933,7 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
                 piles_[i]->AddLayers(overlaps[i].begin(), overlaps[i].end());
                 std::vector<biosoup::Overlap>().swap(overlaps[i]);
               },
-              sequences[k]->id));
+              seeds[k]->id));
         }
         for (const auto& it : void_futures) {
           it.wait();
@@ -696,7 +990,7 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
               << std::fixed << timer.Stop() << "s"
               << std::endl;
 
-    std::sort(sequences.begin(), sequences.end(),
+    std::sort(seeds.begin(), seeds.end(),
         [&] (const std::unique_ptr<biosoup::Sequence>& lhs,
              const std::unique_ptr<biosoup::Sequence>& rhs) -> bool {
           return lhs->id < rhs->id;
@@ -779,14 +1073,7 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
           sequences[it->id()]->name,
           sequences[it->id()]->data.substr(it->begin(), it->end() - it->begin())};  // NOLINT
 
-      sequence_to_node[it->id()] = Node::num_objects;
-
-      auto node = std::make_shared<Node>(sequence);
-      sequence.ReverseAndComplement();
-      nodes_.emplace_back(node);
-      nodes_.emplace_back(std::make_shared<Node>(sequence));
-      node->pair = nodes_.back().get();
-      node->pair->pair = node.get();
+      sequence_to_node[it->id()] = AddNode(sequence);
     }
 
     std::cerr << "[raven::Graph::Construct] stored " << nodes_.size() << " nodes "  // NOLINT
@@ -800,8 +1087,8 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
         continue;
       }
 
-      auto tail = nodes_[sequence_to_node[it.lhs_id]].get();
-      auto head = nodes_[sequence_to_node[it.rhs_id] + 1 - it.strand].get();
+      std::uint32_t tail = sequence_to_node[it.lhs_id];
+      std::uint32_t head = sequence_to_node[it.rhs_id] + 1 - it.strand;
 
       auto length = it.lhs_begin - it.rhs_begin;
       auto length_pair =
@@ -814,12 +1101,9 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
         length_pair *= -1;
       }
 
-      auto edge = std::make_shared<Edge>(tail, head, length);
-      edges_.emplace_back(edge);
-      edges_.emplace_back(std::make_shared<Edge>(head->pair, tail->pair, length_pair));  // NOLINT
-      edge->pair = edges_.back().get();
-      edge->pair->pair = edge.get();
+      AddEdge(tail, head, length, length_pair);
     }
+    CompactAdjacency();
 
     std::cerr << "[raven::Graph::Construct] stored " << edges_.size() << " edges "  // NOLINT
               << std::fixed << timer.Stop() << "s"
@@ -837,12 +1121,176 @@ void Graph::Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences
                 << std::endl;
   }
 
+  // release the index
+  minimizer_engine_ = ram::MinimizerEngine(15, 5, thread_pool_);
+
   std::cerr << "[raven::Graph::Construct] "
             << std::fixed <<  timer.elapsed_time() << "s"
             << std::endl;
 }  // NOLINT
 
-void Graph::Assemble() {
+std::uint32_t Graph::ShardBoundary(
+    const std::vector<std::uint64_t>& num_bytes,
+    std::uint32_t shard,
+    std::uint32_t num_shards) {
+  return std::lower_bound(num_bytes.begin(), num_bytes.end(),
+      num_bytes.back() * std::sqrt(shard / static_cast<double>(num_shards))) -
+      num_bytes.begin();
+}
+
+std::uint64_t Graph::EstimateGenomeSize(
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    std::uint32_t k) {
+
+  // count canonical k-mers with hashes below a limit which is halved each
+  // time the sketch grows too large
+  std::uint64_t mask = (1ULL << (2 * k)) - 1;
+  auto hash = [] (std::uint64_t key) -> std::uint64_t {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+  };
+  auto sketch = [&] (std::uint32_t i, std::uint64_t limit) -> std::vector<std::uint64_t> {  // NOLINT
+    std::vector<std::uint64_t> dst;
+    std::uint64_t fwd = 0, rev = 0;
+    std::uint32_t len = 0;
+    for (const auto& it : sequences[i]->data) {
+      std::uint64_t c;
+      switch (it) {
+        case 'A': case 'a': c = 0; break;
+        case 'C': case 'c': c = 1; break;
+        case 'G': case 'g': c = 2; break;
+        case 'T': case 't': c = 3; break;
+        default: len = 0; continue;
+      }
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((3ULL ^ c) << (2 * (k - 1)));
+      if (++len < k) {
+        continue;
+      }
+      auto h = hash(std::min(fwd, rev));
+      if (h < limit) {
+        dst.emplace_back(h);
+      }
+    }
+    return dst;
+  };
+
+  std::uint64_t limit = -1ULL >> 8;
+  std::unordered_map<std::uint64_t, std::uint32_t> counts;
+
+  std::vector<std::future<std::vector<std::uint64_t>>> thread_futures;
+  for (std::uint32_t i = 0, bytes = 0; i < sequences.size(); ++i) {
+    thread_futures.emplace_back(thread_pool_->Submit(sketch, i, limit));
+
+    bytes += sequences[i]->data.size();
+    if (i != sequences.size() - 1 && bytes < (1U << 28)) {
+      continue;
+    }
+    bytes = 0;
+
+    for (auto& it : thread_futures) {
+      for (const auto& jt : it.get()) {
+        if (jt < limit) {
+          ++counts[jt];
+        }
+      }
+      while (counts.size() > (1U << 20)) {
+        limit >>= 1;
+        for (auto jt = counts.begin(); jt != counts.end();) {
+          jt = jt->first < limit ? std::next(jt) : counts.erase(jt);
+        }
+      }
+    }
+    thread_futures.clear();
+  }
+
+  std::uint64_t num_solid = 0;  // ignore k-mers from sequencing errors
+  for (const auto& it : counts) {
+    num_solid += it.second > 1;
+  }
+  return num_solid * (static_cast<double>(-1ULL) / limit);
+}
+
+std::pair<std::uint32_t, std::uint32_t> Graph::TuneMinimizers(
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    MinimizerParameters parameters) {
+
+  // index every n-th sequence up to 64 MiB and map at most 256 onto them
+  std::uint64_t num_bytes = 0;
+  for (const auto& it : sequences) {
+    num_bytes += it->data.size();
+  }
+  std::uint32_t stride = std::max((num_bytes + (1ULL << 26) - 1) >> 26, 1ULL);
+
+  std::vector<std::unique_ptr<biosoup::Sequence>> targets;
+  for (std::uint32_t i = 0; i < sequences.size(); i += stride) {
+    targets.emplace_back(new biosoup::Sequence());
+    targets.back()->id = sequences[i]->id;
+    targets.back()->data = sequences[i]->data;
+  }
+
+  std::vector<std::uint32_t> queries;
+  for (std::uint32_t i = 0; i < sequences.size(); i += (sequences.size() + 255) / 256) {  // NOLINT
+    queries.emplace_back(i);
+  }
+
+  std::pair<std::uint32_t, std::uint32_t> dst{parameters.k, parameters.w};
+  std::vector<std::uint32_t> yields;
+  std::vector<double> densities;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> candidates;
+  for (std::uint32_t k = 13; k < 23; k += 2) {
+    for (std::uint32_t w = 5; w < 16; w += 5) {
+      candidates.emplace_back(k, w);
+
+      ram::MinimizerEngine minimizer_engine{k, w, thread_pool_};
+      minimizer_engine.Minimize(targets.begin(), targets.end());
+      minimizer_engine.Filter(parameters.frequency);
+
+      std::vector<std::future<std::vector<biosoup::Overlap>>> thread_futures;
+      for (const auto& it : queries) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&] (std::uint32_t i) -> std::vector<biosoup::Overlap> {
+              return minimizer_engine.Map(sequences[i], true, false, true);
+            },
+            it));
+      }
+
+      std::uint32_t yield = 0;
+      double density = 0;
+      for (auto& it : thread_futures) {
+        for (const auto& jt : it.get()) {
+          std::uint32_t length = jt.lhs_end - jt.lhs_begin;
+          if (length < 1000) {  // spurious
+            continue;
+          }
+          ++yield;
+          density += jt.score / static_cast<double>(length);
+        }
+      }
+      yields.emplace_back(yield);
+      densities.emplace_back(yield ? density / yield : 0);
+    }
+  }
+
+  std::uint32_t max_yield = *std::max_element(yields.begin(), yields.end());
+  if (max_yield == 0) {
+    return dst;
+  }
+  double min_density = std::numeric_limits<double>::max();
+  for (std::uint32_t i = 0; i < candidates.size(); ++i) {
+    if (yields[i] >= 0.95 * max_yield && densities[i] < min_density) {
+      min_density = densities[i];
+      dst = candidates[i];
+    }
+  }
+  return dst;
+}
+
+void Graph::Assemble(LongEdgeMode long_edges) {
   if (stage_ < -3 || stage_ > -1) {
     return;
   }
@@ -873,13 +1321,18 @@ void Graph::Assemble() {
   if (stage_ == -2) {  // remove tips and bubbles
     timer.Start();
 
-    while (true) {
-      std::uint32_t num_changes = RemoveTips();
-      num_changes += RemoveBubbles();
-      if (num_changes == 0) {
-        break;
-      }
-    }
+    RemoveTips();
+    auto superbubbles = FindSuperbubbles();
+    auto num_bubbles = RemoveSuperbubbles(superbubbles);
+
+    std::cerr << "[raven::Graph::Assemble] popped " << num_bubbles
+              << " bubbles in " << superbubbles.size() << " superbubbles "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
+
+    timer.Start();
+
+    RemoveTipsAndBubbles();
 
     std::cerr << "[raven::Graph::Assemble] removed tips and bubbles "
               << std::fixed << timer.Stop() << "s"
@@ -901,11 +1354,19 @@ void Graph::Assemble() {
     timer.Start();
 
     CreateUnitigs(42);  // speed up force directed layout
-    RemoveLongEdges(16);
+    std::array<std::uint32_t, 3> agreement = {0, 0, 0};
+    RemoveLongEdges(16, long_edges, &agreement);
 
     std::cerr << "[raven::Graph::Assemble] removed long edges "
               << std::fixed << timer.Stop() << "s"
               << std::endl;
+
+    if (long_edges == LongEdgeMode::kCompare) {
+      std::cerr << "[raven::Graph::Assemble] long edges found by layout "
+                << agreement[0] << ", by neighbourhood " << agreement[1]
+                << ", by both " << agreement[2]
+                << std::endl;
+    }
   }
 
   if (stage_ == -1) {  // checkpoint
@@ -921,13 +1382,8 @@ void Graph::Assemble() {
 
   timer.Start();
 
-  while (true) {  // TODO(rvaser): check if necessary
-     std::uint32_t num_changes = RemoveTips();
-     num_changes += RemoveBubbles();
-     if (num_changes == 0) {
-       break;
-     }
-  }
+  RemoveTipsAndBubbles();  // TODO(rvaser): check if necessary
+  path_similarities_.clear();
 
   timer.Stop();
   std::cerr << "[raven::Graph::Assemble] "
@@ -942,35 +1398,60 @@ std::uint32_t Graph::RemoveTransitiveEdges() {
            (b >= a * (1 - eps) && b <= a * (1 + eps));
   };
 
-  std::vector<Edge*> candidate(nodes_.size(), nullptr);
-  std::unordered_set<std::uint32_t> marked_edges;
-  for (const auto& it : nodes_) {
-    if (it == nullptr) {
-      continue;
-    }
-    for (auto jt : it->outedges) {
-      candidate[jt->head->id] = jt;
-    }
-    for (auto jt : it->outedges) {
-      for (auto kt : jt->head->outedges) {
-        if (candidate[kt->head->id] &&
-            is_comparable(jt->length + kt->length, candidate[kt->head->id]->length)) {  // NOLINT
-          marked_edges.emplace(candidate[kt->head->id]->id);
-          marked_edges.emplace(candidate[kt->head->id]->pair->id);
+  // nodes only read their two-hop neighbourhood and mark only their own out
+  // edges, each range of nodes keeps its own candidates (sorted by head)
+  std::vector<char> is_marked(edges_.size(), 0);
+  ParallelFor(nodes_.size(), kNodeBatchSize,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> candidate;
+        for (std::uint32_t i = first; i < last; ++i) {
+          if (nodes_[i].is_removed) {
+            continue;
+          }
+          candidate.clear();
+          for (auto jt : outedges(i)) {
+            candidate.emplace_back(edges_[jt].head, jt);
+          }
+          std::stable_sort(candidate.begin(), candidate.end(),
+              [] (const std::pair<std::uint32_t, std::uint32_t>& lhs,
+                  const std::pair<std::uint32_t, std::uint32_t>& rhs) -> bool {  // NOLINT
+                return lhs.first < rhs.first;
+              });
+
+          for (auto jt : outedges(i)) {
+            const auto& e = edges_[jt];
+            for (auto kt : outedges(e.head)) {
+              const auto& f = edges_[kt];
+              auto c = std::upper_bound(
+                  candidate.begin(),
+                  candidate.end(),
+                  std::make_pair(f.head, kNil));
+              if (c == candidate.begin() || (--c)->first != f.head) {
+                continue;
+              }
+              const auto& g = edges_[c->second];  // last edge to head
+              if (is_comparable(e.length + f.length, g.length)) {
+                is_marked[g.id] = 1;
+              }
+            }
+          }
         }
-      }
-    }
-    for (auto jt : it->outedges) {
-      candidate[jt->head->id] = nullptr;
+      });
+
+  std::vector<std::uint32_t> marked_edges;
+  for (std::uint32_t i = 0; i < edges_.size(); ++i) {
+    if (is_marked[i]) {
+      marked_edges.emplace_back(i);
+      marked_edges.emplace_back(edges_[i].pair);
     }
   }
 
   for (auto i : marked_edges) {  // store for force directed layout
     if (i & 1) {
-      auto lhs = edges_[i]->tail->id & ~1UL;
-      auto rhs = edges_[i]->head->id & ~1UL;
-      nodes_[lhs]->transitive.emplace(rhs);
-      nodes_[rhs]->transitive.emplace(lhs);
+      auto lhs = edges_[i].tail & ~1UL;
+      auto rhs = edges_[i].head & ~1UL;
+      nodes_[lhs].transitive.emplace(rhs);
+      nodes_[rhs].transitive.emplace(lhs);
     }
   }
 
@@ -979,235 +1460,635 @@ std::uint32_t Graph::RemoveTransitiveEdges() {
 }
 
 std::uint32_t Graph::RemoveTips() {
+  Worklist tips(nodes_.size());
+  return RemoveTips(&tips, nullptr);
+}
+
+std::uint32_t Graph::RemoveTips(Worklist* tips, Worklist* bubbles) {
+  // tips are found in parallel on the graph as it is and replayed in
+  // ascending order, tips whose nodes changed meanwhile are found again, so
+  // the result equals the one of serial removal
+  std::vector<std::uint32_t> candidates;
+  for (auto it : tips->pending()) {
+    if (!nodes_[it].is_removed && nodes_[it].is_tip()) {
+      candidates.emplace_back(it);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<Tip> found(candidates.size());
+  ParallelFor(candidates.size(), kNodeBatchSize,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        for (std::uint32_t i = first; i < last; ++i) {
+          found[i] = FindTip(candidates[i]);
+        }
+      });
+
   std::uint32_t num_tips = 0;
   std::vector<char> is_visited(nodes_.size(), 0);
+  std::vector<char> is_changed(nodes_.size(), 0);
 
-  for (const auto& it : nodes_) {
-    if (it == nullptr || is_visited[it->id] || !it->is_tip()) {
+  tips->Start();
+  std::uint32_t j = 0;
+  for (std::uint32_t i = 0; tips->Next(&i);) {
+    const auto& it = nodes_[i];
+    if (it.is_removed || is_visited[i] || !it.is_tip()) {
       continue;
     }
-    bool is_circular = false;
-    std::uint32_t num_sequences = 0;
 
-    auto end = it.get();
-    while (!end->is_junction()) {
-      num_sequences += end->count;
-      is_visited[end->id] = 1;
-      is_visited[end->pair->id] = 1;
-      if (end->outdegree() == 0 ||
-          end->outedges.front()->head->is_junction()) {
-        break;
-      }
-      end = end->outedges.front()->head;
-      if (end == it.get()) {
-        is_circular = true;
-        break;
-      }
+    while (j < candidates.size() && candidates[j] < i) {
+      ++j;
+    }
+    bool is_valid = j < candidates.size() && candidates[j] == i;
+    for (std::uint32_t k = 0; is_valid && k < found[j].watched.size(); ++k) {
+      is_valid = !is_changed[found[j].watched[k]];
     }
+    Tip tip = is_valid ? std::move(found[j]) : FindTip(i);
 
-    if (is_circular || end->outdegree() == 0 || num_sequences > 5) {
-      continue;
+    for (auto jt : tip.walk) {
+      is_visited[jt] = 1;
+      is_visited[nodes_[jt].pair] = 1;
+    }
+    if (bubbles) {  // tip pair is skipped as visited
+      tips->Watch(i, tip.watched);
+      tips->Watch(nodes_[tip.end].pair, tip.watched);
     }
 
-    std::unordered_set<std::uint32_t> marked_edges;
-    for (auto jt : end->outedges) {
-      if (jt->head->indegree() > 1) {
-        marked_edges.emplace(jt->id);
-        marked_edges.emplace(jt->pair->id);
+    if (!tip.marked_edges.empty()) {
+      auto nodes = RemoveEdges(tip.marked_edges, true);
+      for (auto jt : nodes) {
+        is_changed[jt] = 1;
       }
-    }
-    if (marked_edges.size() / 2 == end->outedges.size()) {  // delete whole
-      auto begin = it.get();
-      while (begin != end) {
-        marked_edges.emplace(begin->outedges.front()->id);
-        marked_edges.emplace(begin->outedges.front()->pair->id);
-        begin = begin->outedges.front()->head;
+      if (bubbles) {
+        tips->Notify(nodes);
+        bubbles->Notify(nodes);
       }
-      ++num_tips;
+      num_tips += tip.is_whole;
     }
-    RemoveEdges(marked_edges, true);
   }
 
   return num_tips;
 }
 
-std::uint32_t Graph::RemoveBubbles() {
-  std::vector<std::uint32_t> distance(nodes_.size(), 0);
-  std::vector<Node*> predecessor(nodes_.size(), nullptr);
+Graph::Tip Graph::FindTip(std::uint32_t begin) const {
+  Tip dst;
+  dst.is_whole = false;
 
-  // path helper functions
-  auto path_extract = [&] (Node* begin, Node* end) -> std::vector<Node*> {
-    std::vector<Node*> dst;
-    while (end != begin) {
-      dst.emplace_back(end);
-      end = predecessor[end->id];
+  bool is_circular = false;
+  std::uint32_t num_sequences = 0;
+
+  auto end = begin;
+  while (!nodes_[end].is_junction()) {
+    num_sequences += nodes_[end].count;
+    dst.walk.emplace_back(end);
+    if (nodes_[end].outdegree() == 0 ||
+        nodes_[edges_[outedges(end).front()].head].is_junction()) {
+      break;
     }
-    dst.emplace_back(begin);
-    std::reverse(dst.begin(), dst.end());
-    return dst;
-  };
-  auto path_type = [] (const std::vector<Node*>& path) -> bool {
-    if (path.empty()) {
-      return false;
+    end = edges_[outedges(end).front()].head;
+    if (end == begin) {
+      is_circular = true;
+      break;
     }
-    for (std::uint32_t i = 1; i < path.size() - 1; ++i) {
-      if (path[i]->is_junction()) {
-        return false;  // complex
-      }
+  }
+  dst.end = end;
+
+  dst.watched = dst.walk;
+  dst.watched.emplace_back(end);
+  for (auto it : outedges(end)) {
+    dst.watched.emplace_back(edges_[it].head);
+  }
+
+  if (is_circular || nodes_[end].outdegree() == 0 || num_sequences > 5) {
+    return dst;
+  }
+
+  for (auto it : outedges(end)) {
+    if (nodes_[edges_[it].head].indegree() > 1) {
+      dst.marked_edges.emplace_back(it);
+      dst.marked_edges.emplace_back(edges_[it].pair);
     }
-    return true;  // without branches
-  };
-  auto bubble_type = [&] (
-      const std::vector<Node*>& lhs,
-      const std::vector<Node*>& rhs) -> bool {
-    if (lhs.empty() || rhs.empty()) {
-      return false;
-    }
-    std::unordered_set<Node*> intersection;
-    for (auto it : lhs) {
-      intersection.emplace(it);
-    }
-    for (auto it : rhs) {
-      intersection.emplace(it);
+  }
+  if (dst.marked_edges.size() / 2 == nodes_[end].outdegree()) {  // delete whole
+    auto it = begin;
+    while (it != end) {
+      const auto& e = edges_[outedges(it).front()];
+      dst.marked_edges.emplace_back(e.id);
+      dst.marked_edges.emplace_back(e.pair);
+      it = e.head;
+    }
+    dst.is_whole = true;
+  }
+
+  return dst;
+}
+
+std::uint32_t Graph::RemoveBubbles() {
+  Worklist bubbles(nodes_.size());
+  return RemoveBubbles(&bubbles, nullptr);
+}
+
+std::uint32_t Graph::RemoveBubbles(Worklist* bubbles, Worklist* tips) {
+  std::vector<std::uint32_t> distance(nodes_.size(), 0);
+  std::vector<std::uint32_t> predecessor(nodes_.size(), kNil);
+
+  std::uint32_t num_bubbles = 0;
+  bubbles->Start();
+  for (std::uint32_t i = 0; bubbles->Next(&i);) {
+    if (nodes_[i].is_removed || nodes_[i].outdegree() < 2) {
+      continue;
     }
-    if (lhs.size() + rhs.size() - 2 != intersection.size()) {
-      return false;
+
+    std::vector<std::uint32_t> visited;
+    auto marked_edges = FindBubble(i, kNil, &distance, &predecessor, &visited);
+    if (tips) {  // search result depends only on visited nodes
+      bubbles->Watch(i, visited);
     }
-    for (auto it : lhs) {
-      if (intersection.count(it->pair) != 0) {
-        return false;
+
+    if (!marked_edges.empty()) {
+      auto nodes = RemoveEdges(marked_edges, true);
+      if (tips) {
+        tips->Notify(nodes);
+        bubbles->Notify(nodes);
       }
+      ++num_bubbles;
     }
-    if (path_type(lhs) && path_type(rhs)) {  // both without branches
-      return true;
+  }
+
+  return num_bubbles;
+}
+
+std::uint32_t Graph::RemoveSuperbubbles(
+    const std::vector<std::pair<std::uint32_t, std::uint32_t>>& superbubbles) {
+  std::vector<std::uint32_t> distance(nodes_.size(), 0);
+  std::vector<std::uint32_t> predecessor(nodes_.size(), kNil);
+
+  std::uint32_t num_bubbles = 0;
+  for (const auto& it : superbubbles) {
+    while (!nodes_[it.first].is_removed && nodes_[it.first].outdegree() > 1) {
+      std::vector<std::uint32_t> visited;
+      auto marked_edges = FindBubble(
+          it.first,
+          it.second,
+          &distance,
+          &predecessor,
+          &visited);
+      if (marked_edges.empty()) {
+        break;
+      }
+      RemoveEdges(marked_edges, true);
+      ++num_bubbles;
     }
+  }
 
-    auto path_sequence = [] (const std::vector<Node*>& path) ->
-        std::unique_ptr<biosoup::Sequence> {
-      auto sequence =
-          std::unique_ptr<biosoup::Sequence>(new biosoup::Sequence());
-      for (std::uint32_t i = 0; i < path.size() - 1; ++i) {
-        for (auto it : path[i]->outedges) {
-          if (it->head == path[i + 1]) {
-            sequence->data += it->Label();
-            break;
-          }
+  return num_bubbles;
+}
+
+std::vector<std::pair<std::uint32_t, std::uint32_t>> Graph::FindSuperbubbles() const {  // NOLINT
+  // reverse postorder of DFS started from sources first is topological on
+  // the acyclic part of the graph and keeps each superbubble contiguous
+  std::vector<std::uint32_t> order;
+  order.reserve(nodes_.size());
+
+  std::vector<char> is_visited(nodes_.size(), 0);
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> stack;  // node, edge
+  auto dfs = [&] (std::uint32_t root) -> void {
+    if (nodes_[root].is_removed || is_visited[root]) {
+      return;
+    }
+    is_visited[root] = 1;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      auto jt = stack.back().first;
+      auto kt = stack.back().second;
+      if (kt < nodes_[jt].outdegree()) {
+        ++stack.back().second;
+        auto head = edges_[outedges(jt)[kt]].head;
+        if (!is_visited[head]) {
+          is_visited[head] = 1;
+          stack.emplace_back(head, 0);
         }
+      } else {
+        order.emplace_back(jt);
+        stack.pop_back();
       }
-      sequence->data += path.back()->data;
-      return std::move(sequence);
-    };
+    }
+  };
+  for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i].indegree() == 0) {
+      dfs(i);
+    }
+  }
+  for (std::uint32_t i = 0; i < nodes_.size(); ++i) {  // cycles
+    dfs(i);
+  }
+  std::reverse(order.begin(), order.end());
 
-    auto ls = path_sequence(lhs);
-    auto rs = path_sequence(rhs);
+  std::vector<std::uint32_t> position(nodes_.size(), kNil);
+  for (std::uint32_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+  }
 
-    if (std::min(ls->data.size(), rs->data.size()) <
-        std::max(ls->data.size(), rs->data.size()) * 0.8) {
-      return false;
+  // entrance candidates with aggregates over [begin, next candidate) for
+  // children and (begin, next candidate] for parents, interval [s, t] is a
+  // superbubble if all edges inside point forward, children of [s, t) lie
+  // before t and parents of (s, t] lie after s
+  // inspired by (Gartner et al. 2018)
+  struct Candidate {
+    std::uint32_t begin;
+    std::uint32_t max_child;
+    std::uint32_t min_parent;
+    bool is_valid;
+  };
+  std::vector<Candidate> candidates;
+  auto merge = [&] (const Candidate& c) -> void {
+    auto& it = candidates.back();
+    it.max_child = std::max(it.max_child, c.max_child);
+    it.min_parent = std::min(it.min_parent, c.min_parent);
+    it.is_valid &= c.is_valid;
+  };
+
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> dst;
+  for (std::uint32_t i = 0; i < order.size(); ++i) {
+    auto v = order[i];
+
+    Candidate parents{i, i, i, nodes_[v].indegree() > 0};
+    for (auto it : inedges(v)) {
+      auto p = position[edges_[it].tail];
+      parents.min_parent = std::min(parents.min_parent, p);
+      parents.is_valid &= p < i;
+    }
+    Candidate children{i, i, i, nodes_[v].outdegree() > 0};
+    for (auto it : outedges(v)) {
+      auto p = position[edges_[it].head];
+      children.max_child = std::max(children.max_child, p);
+      children.is_valid &= p > i;
+    }
+
+    if (!candidates.empty()) {
+      merge(parents);
+    }
+    while (!candidates.empty()) {  // v as exit
+      auto c = candidates.back();
+      if (c.is_valid && c.min_parent >= c.begin) {
+        if (c.max_child > i) {
+          break;  // might close later, so do all candidates below
+        }
+        bool is_valid = nodes_[order[c.begin]].outdegree() > 1;  // not an edge
+        for (auto it : outedges(v)) {
+          is_valid &= edges_[it].head != order[c.begin];  // not a cycle
+        }
+        if (is_valid) {
+          dst.emplace_back(order[c.begin], v);
+        }
+      }
+      candidates.pop_back();
+      if (!candidates.empty()) {
+        merge(c);
+      }
     }
+    candidates.emplace_back(children);  // v as entrance
+  }
 
-    auto overlaps = minimizer_engine_.Map(ls, rs);
+  return dst;
+}
 
-    std::uint32_t matches = 0;
-    for (const auto& it : overlaps) {
-      matches = std::max(matches, it.score);
+std::vector<std::uint32_t> Graph::FindBubble(
+    std::uint32_t begin,
+    std::uint32_t exit,
+    std::vector<std::uint32_t>* distance,
+    std::vector<std::uint32_t>* predecessor,
+    std::vector<std::uint32_t>* visited) {
+  auto path_extract = [&] (std::uint32_t begin, std::uint32_t end)
+      -> std::vector<std::uint32_t> {
+    std::vector<std::uint32_t> dst;
+    while (end != begin) {
+      dst.emplace_back(end);
+      end = (*predecessor)[end];
     }
-    return matches > 0.5 * std::min(ls->data.size(), rs->data.size());
+    dst.emplace_back(begin);
+    std::reverse(dst.begin(), dst.end());
+    return dst;
   };
-  // path helper functions
 
-  std::uint32_t num_bubbles = 0;
-  for (const auto& it : nodes_) {
-    if (it == nullptr || it->outdegree() < 2) {
+  // BFS
+  std::uint32_t end = kNil;
+  std::uint32_t other_end = kNil;
+  std::deque<std::uint32_t> que{begin};
+  visited->assign(1, begin);
+  while (!que.empty() && end == kNil) {
+    auto jt = que.front();
+    que.pop_front();
+    if (jt == exit) {  // superbubble bound
       continue;
     }
 
-    // BFS
-    Node* begin = it.get();
-    Node* end = nullptr;
-    Node* other_end = nullptr;
-    std::deque<Node*> que{begin};
-    std::vector<Node*> visited{1, begin};
-    while (!que.empty() && !end) {
-      auto jt = que.front();
-      que.pop_front();
+    for (auto kt : outedges(jt)) {
+      const auto& e = edges_[kt];
+      if (e.head == begin) {  // cycle
+        continue;
+      }
+      if ((*distance)[jt] + e.length > 500000) {  // out of reach
+        continue;
+      }
+      (*distance)[e.head] = (*distance)[jt] + e.length;
+      visited->emplace_back(e.head);
+      que.emplace_back(e.head);
 
-      for (auto kt : jt->outedges) {
-        if (kt->head == begin) {  // cycle
-          continue;
-        }
-        if (distance[jt->id] + kt->length > 500000) {  // out of reach
-          continue;
-        }
-        distance[kt->head->id] = distance[jt->id] + kt->length;
-        visited.emplace_back(kt->head);
-        que.emplace_back(kt->head);
+      if ((*predecessor)[e.head] != kNil) {  // found bubble
+        end = e.head;
+        other_end = jt;
+        break;
+      }
 
-        if (predecessor[kt->head->id]) {  // found bubble
-          end = kt->head;
-          other_end = jt;
-          break;
-        }
+      (*predecessor)[e.head] = jt;
+    }
+  }
 
-        predecessor[kt->head->id] = jt;
+  std::vector<std::uint32_t> dst;
+  if (end != kNil) {
+    auto lhs = path_extract(begin, end);
+    auto rhs = path_extract(begin, other_end);
+    rhs.emplace_back(end);
+
+    if (IsBubble(lhs, rhs)) {
+      std::uint32_t lhs_count = 0;
+      for (auto jt : lhs) {
+        lhs_count += nodes_[jt].count;
+      }
+      std::uint32_t rhs_count = 0;
+      for (auto jt : rhs) {
+        rhs_count += nodes_[jt].count;
+      }
+      dst = FindRemovableEdges(lhs_count > rhs_count ? rhs : lhs);
+      if (dst.empty()) {
+        dst = FindRemovableEdges(lhs_count > rhs_count ? lhs : rhs);
       }
     }
-    std::unordered_set<std::uint32_t> marked_edges;
-    if (end) {
-      auto lhs = path_extract(begin, end);
-      auto rhs = path_extract(begin, other_end);
-      rhs.emplace_back(end);
+  }
 
-      if (bubble_type(lhs, rhs)) {
-        std::uint32_t lhs_count = 0;
-        for (auto jt : lhs) {
-          lhs_count += jt->count;
-        }
-        std::uint32_t rhs_count = 0;
-        for (auto jt : rhs) {
-          rhs_count += jt->count;
-        }
-        marked_edges = FindRemovableEdges(lhs_count > rhs_count ? rhs : lhs);
-        if (marked_edges.empty()) {
-          marked_edges = FindRemovableEdges(lhs_count > rhs_count ? lhs : rhs);
+  for (auto jt : *visited) {
+    (*distance)[jt] = 0;
+    (*predecessor)[jt] = kNil;
+  }
+
+  return dst;
+}
+
+bool Graph::IsBubble(
+    const std::vector<std::uint32_t>& lhs,
+    const std::vector<std::uint32_t>& rhs) {
+  auto path_type = [&] (const std::vector<std::uint32_t>& path) -> bool {
+    if (path.empty()) {
+      return false;
+    }
+    for (std::uint32_t i = 1; i < path.size() - 1; ++i) {
+      if (nodes_[path[i]].is_junction()) {
+        return false;  // complex
+      }
+    }
+    return true;  // without branches
+  };
+
+  if (lhs.empty() || rhs.empty()) {
+    return false;
+  }
+  std::unordered_set<std::uint32_t> intersection;
+  for (auto it : lhs) {
+    intersection.emplace(it);
+  }
+  for (auto it : rhs) {
+    intersection.emplace(it);
+  }
+  if (lhs.size() + rhs.size() - 2 != intersection.size()) {
+    return false;
+  }
+  for (auto it : lhs) {
+    if (intersection.count(nodes_[it].pair) != 0) {
+      return false;
+    }
+  }
+  if (path_type(lhs) && path_type(rhs)) {  // both without branches
+    return true;
+  }
+
+  auto find_edge = [&] (std::uint32_t tail, std::uint32_t head) -> const Edge* {
+    for (auto it : outedges(tail)) {
+      if (edges_[it].head == head) {
+        return &edges_[it];
+      }
+    }
+    return nullptr;
+  };
+  auto path_length = [&] (const std::vector<std::uint32_t>& path)
+      -> std::size_t {
+    std::size_t dst = nodes_[path.back()].data.size();
+    for (std::uint32_t i = 0; i < path.size() - 1; ++i) {
+      dst += find_edge(path[i], path[i + 1])->length;
+    }
+    return dst;
+  };
+  auto path_view = [&] (const std::vector<std::uint32_t>& path)
+      -> std::vector<std::pair<const char*, std::uint32_t>> {  // edge labels
+    std::vector<std::pair<const char*, std::uint32_t>> dst;
+    for (std::uint32_t i = 0; i < path.size() - 1; ++i) {
+      auto it = find_edge(path[i], path[i + 1]);
+      dst.emplace_back(nodes_[it->tail].data.data(), it->length);
+    }
+    dst.emplace_back(
+        nodes_[path.back()].data.data(),
+        nodes_[path.back()].data.size());
+    return dst;
+  };
+
+  // k-mers sampled by hash with their positions in the path sequence
+  constexpr std::uint32_t k = 15;
+  auto path_sketch = [&] (const std::vector<std::uint32_t>& path)
+      -> std::vector<std::pair<std::uint64_t, std::uint32_t>> {
+    auto hash = [] (std::uint64_t key) -> std::uint64_t {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ULL;
+      key ^= key >> 33;
+      return key;
+    };
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> dst;
+    std::uint64_t mask = (1ULL << (2 * k)) - 1;
+    std::uint64_t kmer = 0;
+    std::uint32_t len = 0;
+    for (const auto& it : path_view(path)) {
+      for (std::uint32_t i = 0; i < it.second; ++i, ++len) {
+        kmer = ((kmer << 2) | ((it.first[i] >> 1) & 3)) & mask;
+        if (len + 1 >= k) {
+          auto key = hash(kmer);
+          if ((key & 3) == 0) {
+            dst.emplace_back(key, len + 1 - k);
+          }
         }
       }
     }
+    return dst;
+  };
+
+  auto ll = path_length(lhs);
+  auto rl = path_length(rhs);
+  if (std::min(ll, rl) < std::max(ll, rl) * 0.8) {
+    return false;
+  }
+
+  const auto& first = lhs < rhs ? lhs : rhs;
+  const auto& second = lhs < rhs ? rhs : lhs;
+  auto& similarity = path_similarities_[
+      (static_cast<std::uint64_t>(lhs.front()) << 32) | lhs.back()];
+  if (similarity.first == first && similarity.second == second) {
+    return similarity.is_similar;
+  }
+
+  // sampled k-mers of the shorter path are looked up in the longer one, and
+  // the longest colinear chain of hits has to cover over a half of the
+  // shorter path, so that hits in repeats are not counted twice
+  auto query = path_sketch(ll < rl ? lhs : rhs);
+  auto target = path_sketch(ll < rl ? rhs : lhs);
+  std::sort(target.begin(), target.end());
+
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> hits;
+  for (const auto& it : query) {
+    auto begin = std::lower_bound(
+        target.begin(),
+        target.end(),
+        std::make_pair(it.first, std::uint32_t(0)));
+    auto end = begin;
+    while (end != target.end() && end->first == it.first) {
+      ++end;
+    }
+    if (end - begin > 8) {  // highly repetitive
+      continue;
+    }
+    while (end != begin) {  // descending so that a chain takes one of them
+      --end;
+      hits.emplace_back(it.second, end->second);
+    }
+  }
 
-    for (auto jt : visited) {
-      distance[jt->id] = 0;
-      predecessor[jt->id] = nullptr;
+  std::vector<std::uint32_t> chain;  // longest increasing in the longer path
+  std::vector<std::uint32_t> predecessor(hits.size(), kNil);
+  for (std::uint32_t i = 0; i < hits.size(); ++i) {
+    auto it = std::lower_bound(
+        chain.begin(),
+        chain.end(),
+        hits[i].second,
+        [&] (std::uint32_t j, std::uint32_t position) -> bool {
+          return hits[j].second < position;
+        });
+    if (it != chain.begin()) {
+      predecessor[i] = *(it - 1);
+    }
+    if (it == chain.end()) {
+      chain.emplace_back(i);
+    } else {
+      *it = i;
     }
+  }
 
-    RemoveEdges(marked_edges, true);
-    num_bubbles += 1 - marked_edges.empty();
+  std::uint32_t matches = 0;
+  std::uint32_t begin = kNil;  // of the covered stretch in the shorter path
+  for (auto i = chain.empty() ? kNil : chain.back();
+       i != kNil;
+       i = predecessor[i]) {
+    matches += std::min(k, begin - hits[i].first);
+    begin = hits[i].first;
   }
 
-  return num_bubbles;
+  similarity.first = first;
+  similarity.second = second;
+  similarity.is_similar = matches > 0.5 * std::min(ll, rl);
+  return similarity.is_similar;
+}
+
+std::uint32_t Graph::RemoveTipsAndBubbles() {
+  Worklist tips(nodes_.size());
+  Worklist bubbles(nodes_.size());
+
+  std::uint32_t num_changes = 0;
+  while (true) {
+    std::uint32_t num_round_changes = RemoveTips(&tips, &bubbles);
+    num_round_changes += RemoveBubbles(&bubbles, &tips);
+    if (num_round_changes == 0) {
+      break;
+    }
+    num_changes += num_round_changes;
+  }
+  return num_changes;
 }
 
-std::uint32_t Graph::RemoveLongEdges(std::uint32_t num_rounds) {
+std::uint32_t Graph::RemoveLongEdges(
+    std::uint32_t num_rounds,
+    LongEdgeMode mode,
+    std::array<std::uint32_t, 3>* agreement) {
   std::uint32_t num_long_edges = 0;
 
+  // positions of even node ids, a round following edge removal refines the
+  // previous layout, otherwise layouts are drawn anew
+  auto unplaced = std::make_pair(
+      std::numeric_limits<double>::quiet_NaN(),
+      std::numeric_limits<double>::quiet_NaN());
+  std::vector<std::pair<double, double>> positions(nodes_.size(), unplaced);
+
+  // even ids of marked edges
+  auto canonical = [] (const std::vector<std::uint32_t>& edges)
+      -> std::vector<std::uint32_t> {
+    std::vector<std::uint32_t> dst;
+    for (auto it : edges) {
+      dst.emplace_back(it & ~1U);
+    }
+    std::sort(dst.begin(), dst.end());
+    dst.erase(std::unique(dst.begin(), dst.end()), dst.end());
+    return dst;
+  };
+
   for (std::uint32_t i = 0; i < num_rounds; ++i) {
-    CreateForceDirectedLayout();
+    std::vector<std::uint32_t> marked_edges;
+    if (mode == LongEdgeMode::kNeighbourhood) {
+      CreateNeighbourhoodWeights();
+      marked_edges = FindLongEdges();
+    } else {
+      CreateForceDirectedLayout("", &positions);
+      marked_edges = FindLongEdges();
+
+      if (mode == LongEdgeMode::kCompare && agreement != nullptr) {
+        // neighbourhood weights are kept only for the comparison, edges of
+        // components skipped by the layout still need their own weights
+        std::vector<double> weights;
+        weights.reserve(edges_.size());
+        for (const auto& it : edges_) {
+          weights.emplace_back(it.weight);
+        }
 
-    std::unordered_set<std::uint32_t> marked_edges;
-    for (const auto& it : nodes_) {
-      if (it == nullptr || it->outdegree() < 2) {
-        continue;
-      }
-      for (auto jt : it->outedges) {
-        for (auto kt : it->outedges) {
-          if (jt != kt && jt->weight * 2.0 < kt->weight) {  // TODO(rvaser)
-            marked_edges.emplace(kt->id);
-            marked_edges.emplace(kt->pair->id);
-          }
+        CreateNeighbourhoodWeights();
+        auto lhs = canonical(marked_edges);
+        auto rhs = canonical(FindLongEdges());
+
+        for (std::uint32_t j = 0; j < edges_.size(); ++j) {
+          edges_[j].weight = weights[j];
         }
+        std::vector<std::uint32_t> shared;
+        std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            std::back_inserter(shared));
+
+        (*agreement)[0] += lhs.size();
+        (*agreement)[1] += rhs.size();
+        (*agreement)[2] += shared.size();
       }
     }
     RemoveEdges(marked_edges);
     num_long_edges += marked_edges.size() / 2;
+    if (marked_edges.empty()) {
+      if (mode == LongEdgeMode::kNeighbourhood) {  // later rounds see the same
+        break;
+      }
+      std::fill(positions.begin(), positions.end(), unplaced);
+    }
 
     RemoveTips();
   }
@@ -1215,18 +2096,78 @@ std::uint32_t Graph::RemoveLongEdges(std::uint32_t num_rounds) {
   return num_long_edges;
 }
 
-void Graph::CreateForceDirectedLayout(const std::string& path) {
-  std::ofstream os;
-  bool is_first = true;
-  if (!path.empty()) {
-    os.open(path);
-    os << "{" << std::endl;
+std::vector<std::uint32_t> Graph::FindLongEdges() const {
+  std::vector<std::uint32_t> dst;
+  for (const auto& it : nodes_) {
+    if (it.is_removed || it.outdegree() < 2) {
+      continue;
+    }
+    for (auto jt : outedges(it.id)) {
+      const auto& e = edges_[jt];
+      for (auto kt : outedges(it.id)) {
+        if (jt != kt && e.weight * 2.0 < edges_[kt].weight) {  // TODO(rvaser)
+          dst.emplace_back(kt);
+          dst.emplace_back(edges_[kt].pair);
+        }
+      }
+    }
   }
+  return dst;
+}
 
-  std::vector<std::unordered_set<std::uint32_t>> components;
-  std::vector<char> is_visited(piles_.size(), 0);
+void Graph::CreateNeighbourhoodWeights() {
+  // node pairs (even ids) adjacent to node n as in the layout, without edge e
+  auto neighbours = [&] (std::uint32_t n, const Edge& e)
+      -> std::vector<std::uint32_t> {
+    std::vector<std::uint32_t> dst;
+    for (auto it : inedges(n)) {
+      if (it != e.id && it != e.pair) {
+        dst.emplace_back((edges_[it].tail >> 1) << 1);
+      }
+    }
+    for (auto it : outedges(n)) {
+      if (it != e.id && it != e.pair) {
+        dst.emplace_back((edges_[it].head >> 1) << 1);
+      }
+    }
+    for (auto it : nodes_[n].transitive) {
+      if (!nodes_[it].is_removed) {
+        dst.emplace_back(it);
+      }
+    }
+    std::sort(dst.begin(), dst.end());
+    dst.erase(std::unique(dst.begin(), dst.end()), dst.end());
+    return dst;
+  };
+
+  ParallelFor(nodes_.size(), kNodeBatchSize,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        std::vector<std::uint32_t> shared;
+        for (std::uint32_t i = first; i < last; ++i) {
+          if (nodes_[i].is_removed || nodes_[i].outdegree() < 2) {
+            continue;
+          }
+          for (auto it : outedges(i)) {
+            auto& e = edges_[it];
+            auto lhs = neighbours((e.tail >> 1) << 1, e);
+            auto rhs = neighbours((e.head >> 1) << 1, e);
+            shared.clear();
+            std::set_intersection(lhs.begin(), lhs.end(),
+                rhs.begin(), rhs.end(), std::back_inserter(shared));
+            e.weight = 1. / (1. + shared.size());
+          }
+        }
+      });
+}
+
+void Graph::CreateForceDirectedLayout(
+    const std::string& path,
+    std::vector<std::pair<double, double>>* positions) {
+  // components of node pairs, represented by their even ids
+  std::vector<std::vector<std::uint32_t>> components;
+  std::vector<char> is_visited(nodes_.size(), 0);
   for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
-    if (nodes_[i] == nullptr || is_visited[i]) {
+    if (nodes_[i].is_removed || is_visited[i]) {
       continue;
     }
 
@@ -1241,41 +2182,44 @@ void Graph::CreateForceDirectedLayout(const std::string& path) {
         continue;
       }
       const auto& node = nodes_[j];
-      is_visited[node->id] = 1;
-      is_visited[node->pair->id] = 1;
-      components.back().emplace((node->id >> 1) << 1);
+      is_visited[node.id] = 1;
+      is_visited[node.pair] = 1;
+      components.back().emplace_back((node.id >> 1) << 1);
 
-      for (auto it : node->inedges) {
-        que.emplace_back(it->tail->id);
+      for (auto it : inedges(j)) {
+        que.emplace_back(edges_[it].tail);
       }
-      for (auto it : node->outedges) {
-        que.emplace_back(it->head->id);
+      for (auto it : outedges(j)) {
+        que.emplace_back(edges_[it].head);
       }
     }
   }
   std::vector<char>().swap(is_visited);
 
   std::sort(components.begin(), components.end(),
-      [] (const std::unordered_set<std::uint32_t>& lhs,
-          const std::unordered_set<std::uint32_t>& rhs) {
+      [] (const std::vector<std::uint32_t>& lhs,
+          const std::vector<std::uint32_t>& rhs) {
         return lhs.size() > rhs.size();
       });
 
+  std::vector<std::uint32_t> component_ids(nodes_.size(), kNil);
+  std::vector<std::uint32_t> local_ids(nodes_.size(), kNil);
+  for (std::uint32_t i = 0; i < components.size(); ++i) {
+    for (std::uint32_t j = 0; j < components[i].size(); ++j) {
+      component_ids[components[i][j]] = i;
+      local_ids[components[i][j]] = j;
+    }
+  }
+
   static std::uint64_t seed = 21;
   seed <<= 1;
 
-  std::mt19937 generator(seed);
-  std::uniform_real_distribution<> distribution(0., 1.);
-
   struct Point {
     Point() = default;
     Point(double x, double y)
         : x(x),
           y(y) {}
 
-    bool operator==(const Point& other) const {
-      return x == other.x && y == other.y;
-    }
     Point operator+(const Point& other) const {
       return Point(x + other.x, y + other.y);
     }
@@ -1303,272 +2247,660 @@ void Graph::CreateForceDirectedLayout(const std::string& path) {
     double y;
   };
 
+  // cells are stored in preorder in flat arrays with the index past their
+  // subtree, point coordinates are copied into two arrays and partitioned
+  // into quadrants (Morton order) while the tree is built so that each cell
+  // covers a contiguous range of them
   struct Quadtree {
-    Quadtree(Point nucleus, double width)
-        : nucleus(nucleus),
-          width(width),
-          center(0, 0),
-          mass(0),
-          subtrees() {
-    }
-
-    bool add(const Point& p) {
-      if (nucleus.x - width > p.x || p.x > nucleus.x + width ||
-          nucleus.y - width > p.y || p.y > nucleus.y + width) {
-        return false;
-      }
-      ++mass;
-      if (mass == 1) {
-        center = p;
-      } else if (subtrees.empty()) {
-        if (center == p) {
-          return true;
-        }
-        double w = width / 2;
-        subtrees.emplace_back(Point(nucleus.x + w, nucleus.y + w), w);
-        subtrees.emplace_back(Point(nucleus.x - w, nucleus.y + w), w);
-        subtrees.emplace_back(Point(nucleus.x - w, nucleus.y - w), w);
-        subtrees.emplace_back(Point(nucleus.x + w, nucleus.y - w), w);
-        for (auto& it : subtrees) {
-          if (it.add(center)) {
+   public:
+    void build(const std::vector<Point>& points, Point nucleus, double width) {
+      px.resize(points.size());
+      py.resize(points.size());
+      for (std::uint32_t i = 0; i < points.size(); ++i) {
+        px[i] = points[i].x;
+        py[i] = points[i].y;
+      }
+      x.clear();
+      y.clear();
+      widths.clear();
+      masses.clear();
+      next.clear();
+      degrees.clear();
+      if (points.empty()) {
+        return;
+      }
+
+      // same order of swaps as std::partition
+      auto partition = [&] (
+          std::uint32_t first,
+          std::uint32_t last,
+          const std::vector<double>& v,
+          double pivot,
+          bool is_greater) -> std::uint32_t {
+        auto pred = [&] (std::uint32_t i) -> bool {
+          return is_greater ? v[i] >= pivot : v[i] <= pivot;
+        };
+        while (true) {
+          while (first != last && pred(first)) {
+            ++first;
+          }
+          if (first == last) {
+            return first;
+          }
+          --last;
+          while (first != last && !pred(last)) {
+            --last;
+          }
+          if (first == last) {
+            return first;
+          }
+          std::swap(px[first], px[last]);
+          std::swap(py[first], py[last]);
+          ++first;
+        }
+      };
+
+      // cells are split top-down in preorder, quadrants are pushed in
+      // reverse so that they are popped in Morton order
+      stack.clear();
+      stack.emplace_back(Cell{0, static_cast<std::uint32_t>(points.size()),
+          nucleus.x, nucleus.y, width});
+      while (!stack.empty()) {
+        auto c = stack.back();
+        stack.pop_back();
+
+        x.emplace_back(px[c.first]);
+        y.emplace_back(py[c.first]);
+        widths.emplace_back(c.width);
+        masses.emplace_back(c.last - c.first);
+        next.emplace_back(0);
+        degrees.emplace_back(0);
+
+        bool is_leaf = true;
+        for (std::uint32_t i = c.first + 1; i < c.last; ++i) {
+          if (px[i] != px[c.first] || py[i] != py[c.first]) {
+            is_leaf = false;
             break;
           }
         }
-      }
-      for (auto& it : subtrees) {
-        if (it.add(p)) {
-          break;
+        if (is_leaf) {
+          continue;
         }
-      }
-      return true;
-    }
 
-    void centre() {
-      if (subtrees.empty()) {
-        return;
+        auto n = partition(c.first, c.last, py, c.y, true);
+        auto ne = partition(c.first, n, px, c.x, true);
+        auto sw = partition(n, c.last, px, c.x, false);
+
+        double w = c.width / 2;
+        Cell quadrants[4] = {
+          {c.first, ne, c.x + w, c.y + w, w},
+          {ne, n, c.x - w, c.y + w, w},
+          {n, sw, c.x - w, c.y - w, w},
+          {sw, c.last, c.x + w, c.y - w, w}};
+        for (std::uint32_t i = 4; i > 0; --i) {
+          if (quadrants[i - 1].first != quadrants[i - 1].last) {
+            stack.emplace_back(quadrants[i - 1]);
+            ++degrees.back();
+          }
+        }
       }
-      center = Point(0, 0);
-      for (auto& it : subtrees) {
-        it.centre();
-        center += it.center * it.mass;
+
+      // subtree ends and centers of mass bottom-up, children follow their
+      // parent and each other
+      for (std::uint32_t i = masses.size(); i > 0; --i) {
+        std::uint32_t j = i - 1;
+        std::uint32_t k = i;
+        if (degrees[j] > 0) {
+          double cx = 0, cy = 0;
+          for (std::uint32_t d = 0; d < degrees[j]; ++d, k = next[k]) {
+            cx += x[k] * masses[k];
+            cy += y[k] * masses[k];
+          }
+          x[j] = cx / masses[j];
+          y[j] = cy / masses[j];
+        }
+        next[j] = k;
       }
-      center /= mass;
     }
 
+    // far cells act through their center of mass, near leaves are ignored
     Point force(const Point& p, double k) const {
-      auto delta = p - center;
-      auto distance = delta.norm();
-      if (width * 2 / distance < 1) {
-        return delta * (mass * (k * k) / (distance * distance));
-      }
-      delta = Point(0, 0);
-      for (const auto& it : subtrees) {
-        delta += it.force(p, k);
+      Point dst(0, 0);
+      for (std::uint32_t i = 0; i < masses.size();) {
+        double dx = p.x - x[i];
+        double dy = p.y - y[i];
+        double distance = sqrt(dx * dx + dy * dy);
+        if (widths[i] * 2 / distance < 1) {
+          double c = masses[i] * (k * k) / (distance * distance);
+          dst.x += dx * c;
+          dst.y += dy * c;
+          i = next[i];
+        } else if (next[i] == i + 1) {
+          i = next[i];
+        } else {
+          ++i;
+        }
       }
-      return delta;
+      return dst;
     }
 
-    Point nucleus;
-    double width;
-    Point center;
-    std::uint32_t mass;
-    std::vector<Quadtree> subtrees;
-  };
+    struct Cell {
+      std::uint32_t first;
+      std::uint32_t last;
+      double x;  // nucleus
+      double y;
+      double width;
+    };
 
-  std::uint32_t c = 0;
-  for (const auto& component : components) {
+    std::vector<double> x;  // center of mass
+    std::vector<double> y;
+    std::vector<double> widths;
+    std::vector<std::uint32_t> masses;
+    std::vector<std::uint32_t> next;
+    std::vector<std::uint32_t> degrees;  // number of children
+    std::vector<double> px;  // points
+    std::vector<double> py;
+    std::vector<Cell> stack;
+  };
+  // components touch disjoint nodes and edges, large ones are laid out one
+  // by one in parallel and the rest concurrently
+  std::vector<std::vector<Point>> points(components.size());
+  auto layout = [&] (std::uint32_t c, bool is_parallel) -> void {
+    const auto& component = components[c];
     if (component.size() < 6) {
-      continue;
+      return;
     }
 
     bool has_junctions = false;
     for (const auto& it : component) {
-      if (nodes_[it]->is_junction()) {
+      if (nodes_[it].is_junction()) {
         has_junctions = true;
         break;
       }
     }
     if (has_junctions == false) {
-      continue;
+      return;
     }
 
-    // update transitive edges
+    // update transitive edges and gather local neighbours (in edges, out
+    // edges and transitive edges of each node)
+    struct Level {
+      std::vector<std::uint32_t> neighbours;
+      std::vector<std::uint32_t> offsets;
+      std::vector<std::uint32_t> parents;  // node ids on the coarser level
+    };
+    std::vector<Level> levels(1);
+    levels[0].offsets.emplace_back(0);
     for (const auto& n : component) {
-      std::unordered_set<std::uint32_t> valid;
-      for (const auto& m : nodes_[n]->transitive) {
-        if (component.find(m) != component.end()) {
+      auto& neighbours = levels[0].neighbours;
+      for (auto e : inedges(n)) {
+        neighbours.emplace_back(local_ids[(edges_[e].tail >> 1) << 1]);
+      }
+      for (auto e : outedges(n)) {
+        neighbours.emplace_back(local_ids[(edges_[e].head >> 1) << 1]);
+      }
+      FlatSet<std::uint32_t> valid;
+      for (const auto& m : nodes_[n].transitive) {
+        if (component_ids[m] == c) {
           valid.emplace(m);
+          neighbours.emplace_back(local_ids[m]);
         }
       }
-      nodes_[n]->transitive.swap(valid);
-    }
-
-    std::uint32_t num_iterations = 100;
-    double k = sqrt(1. / static_cast<double>(component.size()));
-    double t = 0.1;
-    double dt = t / static_cast<double>(num_iterations + 1);
-
-    std::vector<Point> points(nodes_.size());
-    for (const auto& it : component) {
-      points[it].x = distribution(generator);
-      points[it].y = distribution(generator);
-    }
-
-    for (std::uint32_t i = 0; i < num_iterations; ++i) {
-      Point x = {0, 0}, y = {0, 0};
-      for (const auto& n : component) {
-        x.x = std::min(x.x, points[n].x);
-        x.y = std::max(x.y, points[n].x);
-        y.x = std::min(y.x, points[n].y);
-        y.y = std::max(y.y, points[n].y);
-      }
-      double w = (x.y - x.x) / 2, h = (y.y - y.x) / 2;
+      nodes_[n].transitive.swap(valid);
+      levels[0].offsets.emplace_back(neighbours.size());
+    }
+
+    Quadtree tree;
+    std::vector<Point> displacements;
+    // move points of a level while cooling down from temperature t
+    auto relax = [&] (
+        const Level& level,
+        std::uint32_t num_iterations,
+        double t,
+        std::vector<Point>* points) -> void {
+      auto& local_points = *points;
+      std::uint32_t size = local_points.size();
+      double k = sqrt(1. / static_cast<double>(size));
+      double dt = t / static_cast<double>(num_iterations + 1);
+      displacements.resize(size);
+
+      for (std::uint32_t i = 0; i < num_iterations; ++i) {
+        Point x = {0, 0}, y = {0, 0};
+        for (const auto& it : local_points) {
+          x.x = std::min(x.x, it.x);
+          x.y = std::max(x.y, it.x);
+          y.x = std::min(y.x, it.y);
+          y.y = std::max(y.y, it.y);
+        }
+        double w = (x.y - x.x) / 2, h = (y.y - y.x) / 2;
+
+        tree.build(local_points, Point(x.x + w, y.x + h), std::max(w, h) + 0.01);  // NOLINT
+
+        auto thread_task = [&] (std::uint32_t first, std::uint32_t last) -> void {  // NOLINT
+          for (std::uint32_t n = first; n < last; ++n) {
+            auto displacement = tree.force(local_points[n], k);
+            for (std::uint32_t j = level.offsets[n]; j < level.offsets[n + 1]; ++j) {  // NOLINT
+              auto delta = local_points[n] - local_points[level.neighbours[j]];
+              auto distance = delta.norm();
+              if (distance < 0.01) {
+                distance = 0.01;
+              }
+              displacement += delta * (-1. * distance / k);
+            }
+            auto length = displacement.norm();
+            if (length < 0.01) {
+              length = 0.1;
+            }
+            displacements[n] = displacement * (t / length);
+          }
+        };
+        if (is_parallel && size >= kNodeBatchSize) {
+          ParallelFor(size, kNodeBatchSize, thread_task);
+        } else {
+          thread_task(0, size);
+        }
+        for (std::uint32_t j = 0; j < size; ++j) {
+          local_points[j] += displacements[j];
+        }
 
-      Quadtree tree(Point(x.x + w, y.x + h), std::max(w, h) + 0.01);
-      for (const auto& n : component) {
-        tree.add(points[n]);
+        t -= dt;
       }
-      tree.centre();
-
-      std::vector<std::future<void>> thread_futures;
-      std::vector<Point> displacements(nodes_.size(), Point(0, 0));
+    };
 
-      auto thread_task = [&](std::uint32_t n) -> void {
-        auto displacement = tree.force(points[n], k);
-        for (auto e : nodes_[n]->inedges) {
-          auto m = (e->tail->id >> 1) << 1;
-          auto delta = points[n] - points[m];
-          auto distance = delta.norm();
-          if (distance < 0.01) {
-            distance = 0.01;
+    auto& local_points = points[c];
+    local_points.resize(component.size());
+
+    bool is_placed = positions != nullptr;
+    for (std::uint32_t j = 0; j < component.size() && is_placed; ++j) {
+      const auto& it = (*positions)[component[j]];
+      if (std::isnan(it.first)) {
+        is_placed = false;
+      }
+      local_points[j] = Point(it.first, it.second);
+    }
+
+    if (is_placed) {  // warm start, only relax what the last round changed
+      relax(levels[0], 20, 0.02, &local_points);
+    } else {
+      // coarsen large components by matching each node with its unmatched
+      // neighbour of the lowest degree, lay out the coarsest graph and refine
+      // the layout level by level, inspired by (Walshaw 2000), smaller ones
+      // are laid out directly as coarse layouts fold and hide long edges
+      while (levels.back().offsets.size() > kNodeBatchSize) {
+        auto& level = levels.back();
+        std::uint32_t size = level.offsets.size() - 1;
+        auto degree = [&] (std::uint32_t n) -> std::uint32_t {
+          return level.offsets[n + 1] - level.offsets[n];
+        };
+
+        std::vector<std::uint32_t> parents(size, kNil);
+        std::uint32_t num_parents = 0;
+        for (std::uint32_t n = 0; n < size; ++n) {
+          if (parents[n] != kNil) {
+            continue;
           }
-          displacement += delta * (-1. * distance / k);
-        }
-        for (auto e : nodes_[n]->outedges) {
-          auto m = (e->head->id >> 1) << 1;
-          auto delta = points[n] - points[m];
-          auto distance = delta.norm();
-          if (distance < 0.01) {
-            distance = 0.01;
+          std::uint32_t match = kNil;
+          for (std::uint32_t j = level.offsets[n]; j < level.offsets[n + 1]; ++j) {  // NOLINT
+            auto m = level.neighbours[j];
+            if (m != n && parents[m] == kNil &&
+                (match == kNil || degree(m) < degree(match))) {
+              match = m;
+            }
           }
-          displacement += delta * (-1. * distance / k);
-        }
-        for (const auto& m : nodes_[n]->transitive) {
-          auto delta = points[n] - points[m];
-          auto distance = delta.norm();
-          if (distance < 0.01) {
-            distance = 0.01;
+          parents[n] = num_parents;
+          if (match != kNil) {
+            parents[match] = num_parents;
           }
-          displacement += delta * (-1. * distance / k);
+          ++num_parents;
         }
-        auto length = displacement.norm();
-        if (length < 0.01) {
-          length = 0.1;
+        if (num_parents > 0.75 * size) {
+          break;
         }
-        displacements[n] = displacement * (t / length);
-        return;
-      };
 
-      for (const auto& n : component) {
-        thread_futures.emplace_back(thread_pool_->Submit(thread_task, n));
-      }
-      for (const auto& it : thread_futures) {
-        it.wait();
+        std::vector<std::vector<std::uint32_t>> coarse_neighbours(num_parents);
+        for (std::uint32_t n = 0; n < size; ++n) {
+          for (std::uint32_t j = level.offsets[n]; j < level.offsets[n + 1]; ++j) {  // NOLINT
+            auto m = level.neighbours[j];
+            if (parents[n] != parents[m]) {
+              coarse_neighbours[parents[n]].emplace_back(parents[m]);
+            }
+          }
+        }
+        level.parents.swap(parents);
+
+        Level coarse_level;
+        coarse_level.offsets.emplace_back(0);
+        for (auto& it : coarse_neighbours) {
+          std::sort(it.begin(), it.end());
+          it.erase(std::unique(it.begin(), it.end()), it.end());
+          coarse_level.neighbours.insert(
+              coarse_level.neighbours.end(), it.begin(), it.end());
+          coarse_level.offsets.emplace_back(coarse_level.neighbours.size());
+        }
+        levels.emplace_back(std::move(coarse_level));
       }
-      for (const auto& n : component) {
-        points[n] += displacements[n];
+
+      std::mt19937 generator(seed + c);
+      std::uniform_real_distribution<> distribution(0., 1.);
+
+      std::vector<Point> coarse_points(levels.back().offsets.size() - 1);
+      for (auto& it : coarse_points) {
+        it.x = distribution(generator);
+        it.y = distribution(generator);
       }
+      relax(levels.back(), 100, 0.1, &coarse_points);
 
-      t -= dt;
+      // matched nodes start next to their parent
+      for (std::uint32_t i = levels.size() - 1; i > 0; --i) {
+        const auto& level = levels[i - 1];
+        std::vector<Point> fine_points(level.parents.size());
+        double k = sqrt(1. / static_cast<double>(fine_points.size()));
+        for (std::uint32_t j = 0; j < fine_points.size(); ++j) {
+          fine_points[j] = coarse_points[level.parents[j]] + Point(
+              distribution(generator) - 0.5,
+              distribution(generator) - 0.5) * (0.1 * k);
+        }
+        relax(level, 20, 0.02, &fine_points);
+        coarse_points.swap(fine_points);
+      }
+      local_points.swap(coarse_points);
     }
 
-    for (const auto& it : edges_) {
-      if (it == nullptr || it->id & 1) {
-        continue;
+    if (positions != nullptr) {
+      for (std::uint32_t j = 0; j < component.size(); ++j) {
+        (*positions)[component[j]] = std::make_pair(
+            local_points[j].x, local_points[j].y);
       }
-      auto n = (it->tail->id >> 1) << 1;
-      auto m = (it->head->id >> 1) << 1;
+    }
 
-      if (component.find(n) != component.end() &&
-          component.find(m) != component.end()) {
-        it->weight = (points[n] - points[m]).norm();
-        it->pair->weight = it->weight;
+    for (const auto& n : component) {
+      for (auto m : {n, nodes_[n].pair}) {
+        for (auto e : outedges(m)) {
+          auto& it = edges_[e];
+          if (it.id & 1) {
+            continue;
+          }
+          it.weight = (local_points[local_ids[(it.tail >> 1) << 1]] -
+                       local_points[local_ids[(it.head >> 1) << 1]]).norm();
+          edges_[it.pair].weight = it.weight;
+        }
       }
     }
+  };
+
+  std::uint32_t num_large = 0;
+  while (num_large < components.size() &&
+         components[num_large].size() >= kNodeBatchSize) {
+    layout(num_large++, true);
+  }
+  ParallelFor(components.size() - num_large, 1,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        for (std::uint32_t i = first; i < last; ++i) {
+          layout(num_large + i, false);
+        }
+      });
+
+  if (path.empty()) {
+    return;
+  }
+
+  std::ofstream os(path);
+  os << "{" << std::endl;
+
+  bool is_first = true;
+  std::uint32_t c = 0;
+  for (std::uint32_t i = 0; i < components.size(); ++i) {
+    if (points[i].empty()) {
+      continue;
+    }
+    const auto& component = components[i];
+
+    if (!is_first) {
+      os << "," << std::endl;
+    }
+    is_first = false;
+
+    os << "    \"component_" << c++ << "\": {" << std::endl;
 
-    if (!path.empty()) {
-      if (!is_first) {
+    bool is_first_node = true;
+    os << "      \"nodes\": {" << std::endl;
+    for (std::uint32_t j = 0; j < component.size(); ++j) {
+      auto it = component[j];
+      if (!is_first_node) {
         os << "," << std::endl;
       }
-      is_first = false;
-
-      os << "    \"component_" << c++ << "\": {" << std::endl;
+      is_first_node = false;
+      os << "        \"" << it << "\": [";
+      os << points[i][j].x << ", ";
+      os << points[i][j].y << ", ";
+      os << (nodes_[it].is_junction() ? 1 : 0) << ", ";
+      os << nodes_[it].count << "]";
+    }
+    os << std::endl << "      }," << std::endl;
 
-      bool is_first_node = true;
-      os << "      \"nodes\": {" << std::endl;
-      for (const auto& it : component) {
-        if (!is_first_node) {
+    bool is_first_edge = true;
+    os << "      \"edges\": [" << std::endl;
+    for (const auto& it : component) {
+      for (auto e : inedges(it)) {
+        auto o = (edges_[e].tail >> 1) << 1;
+        if (it < o) {
+          continue;
+        }
+        if (!is_first_edge) {
+          os << "," << std::endl;
+        }
+        is_first_edge = false;
+        os << "        [\"" << it << "\", \"" << o << "\", 0]";
+      }
+      for (auto e : outedges(it)) {
+        auto o = (edges_[e].head >> 1) << 1;
+        if (it < o) {
+          continue;
+        }
+        if (!is_first_edge) {
+          os << "," << std::endl;
+        }
+        is_first_edge = false;
+        os << "        [\"" << it << "\", \"" << o << "\", 0]";
+      }
+      for (const auto& o : nodes_[it].transitive) {
+        if (it < o) {
+          continue;
+        }
+        if (!is_first_edge) {
           os << "," << std::endl;
         }
-        is_first_node = false;
-        os << "        \"" << it << "\": [";
-        os << points[it].x << ", ";
-        os << points[it].y << ", ";
-        os << (nodes_[it]->is_junction() ? 1 : 0) << ", ";
-        os << nodes_[it]->count << "]";
-      }
-      os << std::endl << "      }," << std::endl;
-
-      bool is_first_edge = true;
-      os << "      \"edges\": [" << std::endl;
-      for (const auto& it : component) {
-        for (auto e : nodes_[it]->inedges) {
-          auto o = (e->tail->id >> 1) << 1;
-          if (it < o) {
+        is_first_edge = false;
+        os << "        [\"" << it << "\", \"" << o << "\", 1]";
+      }
+    }
+    os << std::endl << "      ]" << std::endl;
+    os << "    }";
+  }
+
+  os << std::endl << "}";
+  os << std::endl;
+  os.close();
+}
+
+void Graph::Polish(
+    std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,  // NOLINT
+    double quality,
+    std::uint8_t match,
+    std::uint8_t mismatch,
+    std::uint8_t gap,
+    std::uint32_t cuda_poa_batches,
+    bool cuda_banded_alignment,
+    std::uint32_t cuda_alignment_batches,
+    std::uint32_t num_rounds) {
+
+  if (sequences.empty() || num_rounds == 0) {
+    return;
+  }
+
+  std::vector<std::uint32_t> ids;  // node of each unitig
+  auto unitigs = GetUnitigs(false, &ids);
+  if (unitigs.empty()) {
+    return;
+  }
+
+  auto polisher = racon::Polisher::Create(
+      quality, 0.3, 500, true,
+      match, mismatch, gap,
+      thread_pool_,
+      cuda_poa_batches,
+      cuda_banded_alignment,
+      cuda_alignment_batches);
+
+  std::vector<char> is_used(sequences.size(), 1);
+
+  // sequences are assigned to the unitig of their longest mapping (the one
+  // racon keeps) the first time some unitigs converge, afterwards they are
+  // realigned to their unitig (indexed once per round) keeping the longest
+  // mapping in a window around their previous position (widened by edits
+  // made since) and only those that fail are mapped again
+  struct Assignment {
+    std::uint32_t id;  // node
+    std::uint32_t begin;
+    std::uint32_t end;
+  };
+  std::vector<Assignment> assignments(sequences.size(), {kNil, 0, 0});
+  std::vector<std::uint64_t> drift(nodes_.size(), 0);
+  bool is_assigned = false;
+
+  while (stage_ < static_cast<std::int32_t>(num_rounds)) {
+    biosoup::Timer timer{};
+    timer.Start();
+
+    std::vector<std::unique_ptr<biosoup::Sequence>> reads;
+    for (std::uint32_t i = 0; i < sequences.size(); ++i) {
+      if (is_used[i]) {
+        reads.emplace_back(std::move(sequences[i]));
+      }
+    }
+
+    polisher->Initialize(unitigs, reads);
+    auto polished = polisher->Polish(false);
+
+    for (std::uint32_t i = 0, j = 0; i < sequences.size(); ++i) {
+      if (is_used[i]) {
+        sequences[i] = std::move(reads[j++]);
+      }
+    }
+
+    std::uint32_t num_unitigs = polished.size();
+    std::uint32_t num_reads = reads.size();
+    unitigs = StoreUnitigs(&polished, &ids, &drift);
+
+    // assignments are only needed by later rounds
+    if (stage_ + 1 < static_cast<std::int32_t>(num_rounds) &&
+        !unitigs.empty() && unitigs.size() < num_unitigs) {
+      ram::MinimizerEngine minimizer_engine{15, 5, thread_pool_};
+
+      std::vector<std::uint32_t> indices(nodes_.size(), kNil);  // of unitigs
+      for (std::uint32_t i = 0; i < ids.size(); ++i) {
+        indices[ids[i]] = i;
+      }
+
+      std::vector<char> is_unassigned(sequences.size(), !is_assigned);
+      if (is_assigned) {  // local realignment, each unitig is indexed once
+        std::vector<std::vector<std::uint32_t>> groups(unitigs.size());
+        for (std::uint32_t i = 0; i < sequences.size(); ++i) {
+          if (!is_used[i] || indices[assignments[i].id] == kNil) {
+            is_used[i] = 0;
             continue;
           }
-          if (!is_first_edge) {
-            os << "," << std::endl;
-          }
-          is_first_edge = false;
-          os << "        [\"" << it << "\", \"" << o << "\", 0]";
+          groups[indices[assignments[i].id]].emplace_back(i);
         }
-        for (auto e : nodes_[it]->outedges) {
-          auto o = (e->head->id >> 1) << 1;
-          if (it < o) {
+
+        for (std::uint32_t i = 0; i < unitigs.size(); ++i) {
+          if (groups[i].empty()) {
             continue;
           }
-          if (!is_first_edge) {
-            os << "," << std::endl;
-          }
-          is_first_edge = false;
-          os << "        [\"" << it << "\", \"" << o << "\", 0]";
+          minimizer_engine.Minimize(
+              unitigs.begin() + i,
+              unitigs.begin() + i + 1);
+          minimizer_engine.Filter(0.001);
+
+          ParallelFor(groups[i].size(), kNodeBatchSize,
+              [&] (std::uint32_t first, std::uint32_t last) -> void {
+                for (std::uint32_t j = first; j < last; ++j) {
+                  auto& it = assignments[groups[i][j]];
+                  std::uint64_t margin = 500 + drift[it.id];
+                  std::uint32_t begin = it.begin - std::min<std::uint64_t>(it.begin, margin);  // NOLINT
+                  std::uint32_t end = std::min<std::uint64_t>(unitigs[i]->data.size(), it.end + margin);  // NOLINT
+                  std::uint32_t length = 999;  // spurious below 1000
+                  is_unassigned[groups[i][j]] = 1;
+                  for (const auto& jt : minimizer_engine.Map(sequences[groups[i][j]], false, false)) {  // NOLINT
+                    if (jt.rhs_begin < begin || jt.rhs_end > end ||
+                        jt.lhs_end - jt.lhs_begin <= length) {
+                      continue;
+                    }
+                    length = jt.lhs_end - jt.lhs_begin;
+                    it.begin = jt.rhs_begin;
+                    it.end = jt.rhs_end;
+                    is_unassigned[groups[i][j]] = 0;
+                  }
+                }
+              });
         }
-        for (const auto& o : nodes_[it]->transitive) {
-          if (it < o) {
-            continue;
-          }
-          if (!is_first_edge) {
-            os << "," << std::endl;
-          }
-          is_first_edge = false;
-          os << "        [\"" << it << "\", \"" << o << "\", 1]";
+      }
+
+      if (std::find(is_unassigned.begin(), is_unassigned.end(), 1) != is_unassigned.end()) {  // NOLINT
+        for (std::uint32_t i = 0; i < unitigs.size(); ++i) {
+          unitigs[i]->id = i;
         }
+        minimizer_engine.Minimize(unitigs.begin(), unitigs.end());
+        minimizer_engine.Filter(0.001);
+
+        ParallelFor(sequences.size(), kNodeBatchSize,
+            [&] (std::uint32_t first, std::uint32_t last) -> void {
+              for (std::uint32_t i = first; i < last; ++i) {
+                if (!is_used[i] || !is_unassigned[i]) {
+                  continue;
+                }
+                auto& it = assignments[i];
+                it.id = kNil;
+                std::uint32_t length = 999;  // spurious below 1000
+                for (const auto& jt : minimizer_engine.Map(sequences[i], false, false)) {  // NOLINT
+                  if (jt.lhs_end - jt.lhs_begin > length) {
+                    length = jt.lhs_end - jt.lhs_begin;
+                    it.id = ids[jt.rhs_id];
+                    it.begin = jt.rhs_begin;
+                    it.end = jt.rhs_end;
+                  }
+                }
+                is_used[i] = it.id != kNil;
+              }
+            });
+        is_assigned = true;
       }
-      os << std::endl << "      ]" << std::endl;
-      os << "    }";
+      std::fill(drift.begin(), drift.end(), 0);
     }
-  }
 
-  if (!path.empty()) {
-    os << std::endl << "}";
-    os << std::endl;
-    os.close();
+    std::cerr << "[raven::Graph::Polish] polished " << num_unitigs
+              << " unitigs with " << num_reads << " sequences, "
+              << (num_unitigs - unitigs.size()) << " converged "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
+
+    timer.Start();
+
+    ++stage_;
+    if (unitigs.empty()) {  // all converged
+      stage_ = static_cast<std::int32_t>(num_rounds);
+    }
+    Store();
+
+    std::cerr << "[raven::Graph::Polish] reached checkpoint "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
   }
 }
 
 void Graph::Polish(
-    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    bioparser::Parser<biosoup::Sequence>* sparser,
+    std::uint64_t chunk_size,
     std::uint8_t match,
     std::uint8_t mismatch,
     std::uint8_t gap,
@@ -1577,64 +2909,266 @@ void Graph::Polish(
     std::uint32_t cuda_alignment_batches,
     std::uint32_t num_rounds) {
 
-  if (sequences.empty() || num_rounds == 0) {
+  if (num_rounds == 0 || stage_ >= static_cast<std::int32_t>(num_rounds)) {
     return;
   }
 
-  auto unitigs = GetUnitigs();
+  std::vector<std::uint32_t> ids;  // node of each unitig
+  auto unitigs = GetUnitigs(false, &ids);
   if (unitigs.empty()) {
     return;
   }
 
-  double q = 0.;
-  for (const auto& it : sequences) {
-    if (it->quality.empty()) {
-      continue;
-    }
-    double p = 0.;
-    for (const auto& jt : it->quality) {
-      p += jt - 33;
-    }
-    q += p / it->quality.size();
+  biosoup::Timer timer{};
+  timer.Start();
+
+  // one pass over the input assigns sequences to the unitig of their longest
+  // mapping, only assigned sequences are read again in each round
+  for (std::uint32_t i = 0; i < unitigs.size(); ++i) {
+    unitigs[i]->id = i;
   }
-  if (q == 0.) {  // when all values equal to '!'
+  ram::MinimizerEngine minimizer_engine{15, 5, thread_pool_};
+  minimizer_engine.Minimize(unitigs.begin(), unitigs.end());
+  minimizer_engine.Filter(0.001);
+
+  std::vector<std::uint32_t> assignments;  // node per sequence
+  std::vector<std::uint64_t> bytes(nodes_.size(), 0);  // of assigned sequences
+  QualityAccumulator quality;
+
+  // next chunk is parsed on a separate thread while the current one is
+  // mapped on the pool
+  auto parse = [&] () -> std::vector<std::unique_ptr<biosoup::Sequence>> {
+    return sparser->Parse(chunk_size);
+  };
+
+  sparser->Reset();
+  auto chunk = std::async(std::launch::async, parse);
+  while (true) {
+    auto sequences = chunk.get();
+    if (sequences.empty()) {
+      break;
+    }
+    chunk = std::async(std::launch::async, parse);
+
+    std::vector<std::uint64_t> sizes;  // before qualities might be dropped
     for (const auto& it : sequences) {
-      it->quality.clear();
+      sizes.emplace_back(it->data.size() + it->quality.size());
+    }
+    quality.Update(&sequences, 0, thread_pool_);
+
+    std::uint32_t offset = assignments.size();
+    assignments.resize(offset + sequences.size(), kNil);
+    ParallelFor(sequences.size(), kNodeBatchSize,
+        [&] (std::uint32_t first, std::uint32_t last) -> void {
+          for (std::uint32_t i = first; i < last; ++i) {
+            std::uint32_t length = 999;  // spurious below 1000
+            for (const auto& it : minimizer_engine.Map(sequences[i], false, false)) {  // NOLINT
+              if (it.lhs_end - it.lhs_begin > length) {
+                length = it.lhs_end - it.lhs_begin;
+                assignments[offset + i] = ids[it.rhs_id];
+              }
+            }
+          }
+        });
+    for (std::uint32_t i = 0; i < sequences.size(); ++i) {
+      if (assignments[offset + i] != kNil) {
+        bytes[assignments[offset + i]] += sizes[i];
+      }
     }
-  } else {
-    q /= sequences.size();
   }
+  if (assignments.empty()) {
+    return;
+  }
+  bool is_quality = !quality.is_uniform();
+
+  std::cerr << "[raven::Graph::Polish] assigned "
+            << (assignments.size() - std::count(assignments.begin(), assignments.end(), kNil))  // NOLINT
+            << " of " << assignments.size() << " sequences "
+            << std::fixed << timer.Stop() << "s"
+            << std::endl;
 
   auto polisher = racon::Polisher::Create(
-      q, 0.3, 500, true,
+      is_quality ? quality.mean() : 0., 0.3, 500, true,
       match, mismatch, gap,
       thread_pool_,
       cuda_poa_batches,
       cuda_banded_alignment,
       cuda_alignment_batches);
 
+  // sequences of each batch are spilled to a file while the input (first
+  // round) or the files of the previous round are read once, racon then
+  // reads back one file at a time, files are removed on every exit path
+  struct SpillFiles {
+    ~SpillFiles() {
+      for (std::uint32_t i = 0; i < num_batches; ++i) {
+        std::remove(path(0, i).c_str());
+        std::remove(path(1, i).c_str());
+      }
+    }
+    static std::string path(std::uint32_t generation, std::uint32_t i) {
+      return "raven.batch" + std::to_string(generation & 1) + "." +
+          std::to_string(i) + ".cereal";
+    }
+    std::uint32_t num_batches = 0;  // most of any round
+  } spill_files;
+  std::uint32_t generation = 0;
+  std::vector<std::uint32_t> num_spilled;  // per batch of previous round
+
   while (stage_ < static_cast<std::int32_t>(num_rounds)) {
-    polisher->Initialize(unitigs, sequences);
-    auto polished = polisher->Polish(false);
-    unitigs.swap(polished);
-
-    for (const auto& it : unitigs) {  // store unitigs
-      const auto& node = nodes_[std::atoi(&it->name[3])];
-      std::size_t tag;
-      if ((tag = it->name.rfind(':')) != std::string::npos) {
-        if (std::atof(&it->name[tag + 1]) > 0) {
-          node->is_polished = true;
-          node->data = it->data;
-          it->ReverseAndComplement();
-          node->pair->data = it->data;
+    timer.Start();
+
+    // racon is invoked on batches of unitigs with at most chunk_size bytes
+    // of assigned sequences (or a single unitig)
+    std::vector<std::uint32_t> batches(nodes_.size(), kNil);
+    std::uint32_t num_batches = 0;
+    std::uint64_t batch_size = 0;
+    for (const auto& id : ids) {
+      if (batch_size > 0 && batch_size + bytes[id] > chunk_size) {
+        ++num_batches;
+        batch_size = 0;
+      }
+      batches[id] = num_batches;
+      batch_size += bytes[id];
+    }
+
+    spill_files.num_batches = std::max(
+        spill_files.num_batches, num_batches + 1);
+
+    std::vector<std::uint32_t> num_sequences(num_batches + 1, 0);
+    {
+      // at most kMaxOpenBatches files are open at once, the one opened first
+      // is closed to make room and appended to when reopened (binary archives
+      // are plain concatenations of values)
+      constexpr std::uint32_t kMaxOpenBatches = 64;
+      std::vector<std::unique_ptr<std::ofstream>> streams(num_batches + 1);
+      std::vector<std::unique_ptr<cereal::BinaryOutputArchive>> archives(
+          num_batches + 1);
+      std::deque<std::uint32_t> opened;
+      auto close = [&] (std::uint32_t i) -> void {
+        archives[i].reset();
+        streams[i]->close();
+        if (streams[i]->fail()) {
+          throw std::logic_error(
+              "[raven::Graph::Polish] error: unable to store batch");
         }
+        streams[i].reset();
+      };
+      auto spill = [&] (std::uint32_t j, biosoup::Sequence* it) -> void {
+        if (assignments[j] == kNil || batches[assignments[j]] == kNil) {
+          return;
+        }
+        if (!is_quality) {
+          it->quality.clear();
+        }
+        std::uint32_t i = batches[assignments[j]];
+        if (!archives[i]) {
+          if (opened.size() == kMaxOpenBatches) {
+            close(opened.front());
+            opened.pop_front();
+          }
+          streams[i].reset(new std::ofstream(
+              SpillFiles::path(generation, i),
+              std::ios::binary |
+                  (num_sequences[i] ? std::ios::app : std::ios::trunc)));
+          archives[i].reset(new cereal::BinaryOutputArchive(*streams[i]));
+          opened.emplace_back(i);
+        }
+        (*archives[i])(j, it->name, it->data, it->quality);
+        ++num_sequences[i];
+      };
+
+      if (num_spilled.empty()) {
+        sparser->Reset();
+        auto chunk = std::async(std::launch::async, parse);
+        for (std::uint32_t j = 0; true;) {
+          auto sequences = chunk.get();
+          if (sequences.empty()) {
+            break;
+          }
+          chunk = std::async(std::launch::async, parse);
+          for (auto& it : sequences) {
+            spill(j++, it.get());
+          }
+        }
+      } else {
+        for (std::uint32_t i = 0; i < num_spilled.size(); ++i) {
+          auto path = SpillFiles::path(generation - 1, i);
+          std::ifstream is(path, std::ios::binary);
+          try {
+            cereal::BinaryInputArchive archive(is);
+            biosoup::Sequence it{};
+            for (std::uint32_t k = 0; k < num_spilled[i]; ++k) {
+              std::uint32_t j;
+              archive(j, it.name, it.data, it.quality);
+              spill(j, &it);
+            }
+          } catch (std::exception&) {
+            throw std::logic_error(
+                "[raven::Graph::Polish] error: unable to load batch");
+          }
+          is.close();
+          std::remove(path.c_str());
+        }
+      }
+
+      for (auto it : opened) {
+        close(it);
       }
     }
+    num_spilled.swap(num_sequences);
+
+    std::uint32_t num_unitigs = unitigs.size();
+    std::uint64_t num_reads = 0;
+    std::vector<std::unique_ptr<biosoup::Sequence>> polished;
+    std::vector<std::uint32_t> polished_ids;
+    for (std::uint32_t i = 0; i <= num_batches; ++i) {
+      std::vector<std::unique_ptr<biosoup::Sequence>> targets;
+      for (std::uint32_t j = 0; j < unitigs.size(); ++j) {
+        if (batches[ids[j]] == i) {
+          targets.emplace_back(std::move(unitigs[j]));
+          polished_ids.emplace_back(ids[j]);
+        }
+      }
+
+      std::vector<std::unique_ptr<biosoup::Sequence>> reads;
+      std::ifstream is(SpillFiles::path(generation, i), std::ios::binary);
+      try {
+        cereal::BinaryInputArchive archive(is);
+        for (std::uint32_t k = 0; k < num_spilled[i]; ++k) {
+          reads.emplace_back(new biosoup::Sequence());
+          auto& it = reads.back();
+          archive(it->id, it->name, it->data, it->quality);
+        }
+      } catch (std::exception&) {
+        throw std::logic_error(
+            "[raven::Graph::Polish] error: unable to load batch");
+      }
+      is.close();
+      num_reads += reads.size();
+
+      polisher->Initialize(targets, reads);
+      for (auto& it : polisher->Polish(false)) {
+        polished.emplace_back(std::move(it));
+      }
+    }
+    ++generation;
+
+    ids.swap(polished_ids);
+    unitigs = StoreUnitigs(&polished, &ids);
+
+    std::cerr << "[raven::Graph::Polish] polished " << num_unitigs
+              << " unitigs in " << (num_batches + 1) << " batches with "
+              << num_reads << " sequences, "
+              << (num_unitigs - unitigs.size()) << " converged "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
 
-    biosoup::Timer timer{};
     timer.Start();
 
     ++stage_;
+    if (unitigs.empty()) {  // all converged
+      stage_ = static_cast<std::int32_t>(num_rounds);
+    }
     Store();
 
     std::cerr << "[raven::Graph::Polish] reached checkpoint "
@@ -1643,146 +3177,305 @@ void Graph::Polish(
   }
 }
 
-std::uint32_t Graph::CreateUnitigs(std::uint32_t epsilon) {
-  std::unordered_set<std::uint32_t> marked_edges;
-  std::vector<std::shared_ptr<Node>> unitigs;
-  std::vector<std::shared_ptr<Edge>> unitig_edges;
-  std::vector<std::uint32_t> node_updates(nodes_.size(), 0);
-  std::vector<char> is_visited(nodes_.size(), 0);
-
-  for (const auto& it : nodes_) {
-    if (it == nullptr || is_visited[it->id] || it->is_junction()) {
-      continue;
+std::vector<std::unique_ptr<biosoup::Sequence>> Graph::StoreUnitigs(
+    std::vector<std::unique_ptr<biosoup::Sequence>>* polished,
+    std::vector<std::uint32_t>* ids,
+    std::vector<std::uint64_t>* drift) {
+
+  // estimated number of edits between two versions of a unitig, i.e. the
+  // number of k-mers of rhs missing from lhs over k, k-mers of unitigs longer
+  // than 1 Mbp are sampled by hash so that ~2^20 of them are kept
+  auto num_edits = [] (const std::string& lhs, const std::string& rhs)
+      -> std::uint64_t {
+    constexpr std::uint32_t k = 16;
+    std::uint64_t scale = std::max<std::uint64_t>(lhs.size() >> 20, 1);
+    auto hash = [] (std::uint64_t key) -> std::uint64_t {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ULL;
+      key ^= key >> 33;
+      return key;
+    };
+    auto kmers = [&] (const std::string& data) -> std::vector<std::uint64_t> {
+      std::vector<std::uint64_t> dst;
+      dst.reserve(data.size() / scale + 1);
+      std::uint64_t kmer = 0;
+      for (std::uint32_t i = 0; i < data.size(); ++i) {
+        kmer = ((kmer << 2) | ((data[i] >> 1) & 3)) & ((1ULL << (2 * k)) - 1);
+        if (i + 1 >= k && (scale == 1 || hash(kmer) % scale == 0)) {
+          dst.emplace_back(kmer);
+        }
+      }
+      return dst;
+    };
+    auto lhs_kmers = kmers(lhs);
+    std::sort(lhs_kmers.begin(), lhs_kmers.end());
+    std::uint64_t dst = 0;
+    for (const auto& it : kmers(rhs)) {
+      dst += !std::binary_search(lhs_kmers.begin(), lhs_kmers.end(), it);
     }
+    return (dst * scale + k - 1) / k;
+  };
 
-    std::uint32_t extension = 1;
+  // unitigs with less than kConvergence edits per base are left out of
+  // subsequent rounds
+  constexpr double kConvergence = 0.0001;
+
+  // racon reports the fraction of polished windows only in the last tag of
+  // the name (XC:f:<fraction>), which is read here once, unitigs without
+  // polished windows are left as they are and stay in the next round, as do
+  // unitigs without a readable tag (which are reported)
+  std::vector<char> is_converged(polished->size(), 0);
+  std::vector<char> is_tagged(polished->size(), 1);
+  ParallelFor(polished->size(), kNodeBatchSize,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        for (std::uint32_t i = first; i < last; ++i) {
+          auto& it = (*polished)[i];
+          std::size_t tag = it->name.rfind(" XC:f:");
+          double fraction = 0;
+          if (tag != std::string::npos) {
+            const char* begin = it->name.c_str() + tag + 6;
+            char* end;
+            fraction = std::strtod(begin, &end);
+            is_tagged[i] = end != begin && *end == '\0';
+          } else {
+            is_tagged[i] = 0;
+          }
+          if (!is_tagged[i] || !(fraction > 0)) {
+            it->data = nodes_[(*ids)[i]].data;
+            continue;
+          }
 
-    bool is_circular = false;
-    auto begin = it.get();
-    while (!begin->is_junction()) {  // extend left
-      is_visited[begin->id] = 1;
-      is_visited[begin->pair->id] = 1;
-      if (begin->indegree() == 0 ||
-          begin->inedges.front()->tail->is_junction()) {
-        break;
-      }
-      begin = begin->inedges.front()->tail;
-      ++extension;
-      if (begin == it.get()) {
-        is_circular = true;
-        break;
-      }
+          auto& node = nodes_[(*ids)[i]];
+          std::uint64_t edits = num_edits(node.data, it->data);
+
+          node.is_polished = true;
+          node.data = it->data;
+          it->ReverseAndComplement();
+          nodes_[node.pair].data.swap(it->data);
+
+          if (edits >= kConvergence * node.data.size()) {
+            if (drift) {
+              (*drift)[node.id] += edits;
+            }
+            it->data = node.data;
+          } else {
+            is_converged[i] = 1;
+          }
+        }
+      });
+
+  auto num_untagged = std::count(is_tagged.begin(), is_tagged.end(), 0);
+  if (num_untagged > 0) {
+    std::cerr << "[raven::Graph::StoreUnitigs] " << num_untagged
+              << " unitigs without a polishing tag are kept unchanged"
+              << std::endl;
+  }
+
+  std::vector<std::unique_ptr<biosoup::Sequence>> dst;
+  for (std::uint32_t i = 0; i < polished->size(); ++i) {
+    if (!is_converged[i]) {
+      (*ids)[dst.size()] = (*ids)[i];
+      dst.emplace_back(std::move((*polished)[i]));
     }
+  }
+  ids->resize(dst.size());
+  return dst;
+}
 
-    auto end = it.get();
-    while (!end->is_junction()) {  // extend right
-      is_visited[end->id] = 1;
-      is_visited[end->pair->id] = 1;
-      if (end->outdegree() == 0 ||
-          end->outedges.front()->head->is_junction()) {
-        break;
+std::uint32_t Graph::CreateUnitigs(std::uint32_t epsilon) {
+  // maximal paths of non-junction nodes, kept on the strand of their
+  // smallest id and created in its order (junctions and nodes of other paths
+  // are the only ones touched by connecting a path, so paths found on the
+  // initial graph are the ones a serial sweep would find)
+  struct Path {
+    std::uint32_t first;
+    std::uint32_t begin;
+    std::uint32_t end;
+    bool is_circular;
+  };
+
+  std::vector<char> is_visited(nodes_.size(), 0);
+  auto is_valid = [&] (Path* path, std::uint32_t extension) -> bool {
+    if (!path->is_circular && path->begin == path->end) {
+      return false;
+    }
+    if (!path->is_circular && extension < 2 * epsilon + 2) {
+      return false;
+    }
+    if (path->begin != path->end) {  // remove nodes near junctions
+      for (std::uint32_t j = 0; j < epsilon; ++j) {
+        path->begin = edges_[outedges(path->begin).front()].head;
       }
-      end = end->outedges.front()->head;
-      ++extension;
-      if (end == it.get()) {
-        is_circular = true;
-        break;
+      for (std::uint32_t j = 0; j < epsilon; ++j) {
+        path->end = edges_[inedges(path->end).front()].tail;
       }
     }
+    return true;
+  };
 
-    if (!is_circular && begin == end) {
-      continue;
-    }
-    if (!is_circular && extension < 2 * epsilon + 2) {
+  std::vector<std::future<std::vector<Path>>> thread_futures;
+  for (std::uint32_t i = 0; i < nodes_.size(); i += kNodeBatchSize) {
+    thread_futures.emplace_back(thread_pool_->Submit(
+        [&] (std::uint32_t first, std::uint32_t last) -> std::vector<Path> {
+          std::vector<Path> dst;
+          for (std::uint32_t i = first; i < last; ++i) {
+            if (nodes_[i].is_removed || nodes_[i].is_junction() ||
+                (nodes_[i].indegree() &&
+                 !nodes_[edges_[inedges(i).front()].tail].is_junction())) {
+              continue;
+            }
+
+            Path path = { i, i, i, false };
+            std::uint32_t extension = 1;
+            std::uint32_t first_pair = nodes_[i].pair;
+            is_visited[i] = 1;
+            while (nodes_[path.end].outdegree() &&
+                   !nodes_[edges_[outedges(path.end).front()].head].is_junction()) {  // NOLINT
+              path.end = edges_[outedges(path.end).front()].head;
+              path.first = std::min(path.first, path.end);
+              first_pair = std::min(first_pair, nodes_[path.end].pair);
+              is_visited[path.end] = 1;
+              ++extension;
+            }
+            if (path.first <= first_pair && is_valid(&path, extension)) {
+              dst.emplace_back(path);
+            }
+          }
+          return dst;
+        },
+        i,
+        std::min(i + kNodeBatchSize, static_cast<std::uint32_t>(nodes_.size()))));  // NOLINT
+  }
+  std::vector<Path> paths;
+  for (auto& it : thread_futures) {
+    auto dst = it.get();
+    paths.insert(paths.end(), dst.begin(), dst.end());
+  }
+
+  for (std::uint32_t i = 0; i < nodes_.size(); ++i) {  // cycles
+    if (nodes_[i].is_removed || is_visited[i] || nodes_[i].is_junction()) {
       continue;
     }
+    auto jt = i;
+    do {
+      is_visited[jt] = 1;
+      is_visited[nodes_[jt].pair] = 1;
+      jt = edges_[outedges(jt).front()].head;
+    } while (jt != i);
+    paths.push_back({ i, i, i, true });
+  }
+  std::vector<char>().swap(is_visited);
 
-    if (begin != end) {  // remove nodes near junctions
-      for (std::uint32_t i = 0; i < epsilon; ++i) {
-        begin = begin->outedges.front()->head;
-      }
-      for (std::uint32_t i = 0; i < epsilon; ++i) {
-        end = end->inedges.front()->tail;
-      }
-    }
+  std::sort(paths.begin(), paths.end(),
+      [] (const Path& lhs, const Path& rhs) -> bool {
+        return lhs.first < rhs.first;
+      });
+
+  // merge sequences of both strands in parallel
+  std::uint32_t id = nodes_.size();
+  std::vector<Node> unitigs(2 * paths.size());
+  std::vector<std::uint32_t> node_updates(nodes_.size(), 0);
+  ParallelFor(paths.size(), kNodeBatchSize,
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        for (std::uint32_t i = first; i < last; ++i) {
+          const auto& path = paths[i];
+          auto& unitig = unitigs[2 * i];
+          unitig = MergePath(id + 2 * i, path.begin, path.end);
+          unitig.pair = id + 2 * i + 1;
+          unitigs[2 * i + 1] = MergePath(
+              id + 2 * i + 1,
+              nodes_[path.end].pair,
+              nodes_[path.begin].pair);
+          unitigs[2 * i + 1].pair = id + 2 * i;
+
+          auto jt = path.begin;
+          while (true) {  // update transitive edges
+            node_updates[jt & ~1UL] = unitig.id;
+            unitig.transitive.insert(
+                nodes_[jt & ~1UL].transitive.begin(),
+                nodes_[jt & ~1UL].transitive.end());
+            if ((jt = edges_[outedges(jt).front()].head) == path.end) {
+              break;
+            }
+          }
+        }
+      });
+  for (auto& it : unitigs) {
+    nodes_.emplace_back(std::move(it));
+  }
+  std::vector<Node>().swap(unitigs);
 
-    auto unitig = std::make_shared<Node>(begin, end);
-    unitigs.emplace_back(unitig);
-    unitigs.emplace_back(std::make_shared<Node>(end->pair, begin->pair));
-    unitig->pair = unitigs.back().get();
-    unitig->pair->pair = unitig.get();
+  std::vector<std::uint32_t> marked_edges;
+  for (const auto& it : paths) {
+    auto begin = it.begin;
+    auto end = it.end;
+    auto unitig = id;
+    id += 2;
 
     if (begin != end) {  // connect unitig to graph
-      if (begin->indegree()) {
-        marked_edges.emplace(begin->inedges.front()->id);
-        marked_edges.emplace(begin->inedges.front()->pair->id);
-
-        auto edge = std::make_shared<Edge>(
-            begin->inedges.front()->tail,
-            unitig.get(),
-            begin->inedges.front()->length);
-        unitig_edges.emplace_back(edge);
-        unitig_edges.emplace_back(std::make_shared<Edge>(
-            unitig->pair,
-            begin->inedges.front()->pair->head,
-            begin->inedges.front()->pair->length + unitig->pair->data.size() - begin->pair->data.size()));  // NOLINT
-        edge->pair = unitig_edges.back().get();
-        edge->pair->pair = edge.get();
-      }
-      if (end->outdegree()) {
-        marked_edges.emplace(end->outedges.front()->id);
-        marked_edges.emplace(end->outedges.front()->pair->id);
-
-        auto edge = std::make_shared<Edge>(
-            unitig.get(),
-            end->outedges.front()->head,
-            end->outedges.front()->length + unitig->data.size() - end->data.size());  // NOLINT
-        unitig_edges.emplace_back(edge);
-        unitig_edges.emplace_back(std::make_shared<Edge>(
-            end->outedges.front()->pair->tail,
-            unitig->pair,
-            end->outedges.front()->pair->length));
-        edge->pair = unitig_edges.back().get();
-        edge->pair->pair = edge.get();
+      if (nodes_[begin].indegree()) {
+        auto e = edges_[inedges(begin).front()].id;
+        marked_edges.emplace_back(e);
+        marked_edges.emplace_back(edges_[e].pair);
+
+        AddEdge(
+            edges_[e].tail,
+            unitig,
+            edges_[e].length,
+            edges_[edges_[e].pair].length + nodes_[unitig + 1].data.size() - nodes_[nodes_[begin].pair].data.size());  // NOLINT
+      }
+      if (nodes_[end].outdegree()) {
+        auto e = edges_[outedges(end).front()].id;
+        marked_edges.emplace_back(e);
+        marked_edges.emplace_back(edges_[e].pair);
+
+        AddEdge(
+            unitig,
+            edges_[e].head,
+            edges_[e].length + nodes_[unitig].data.size() - nodes_[end].data.size(),  // NOLINT
+            edges_[edges_[e].pair].length);
       }
     }
 
     auto jt = begin;
     while (true) {
-      marked_edges.emplace(jt->outedges.front()->id);
-      marked_edges.emplace(jt->outedges.front()->pair->id);
-
-      // update transitive edges
-      node_updates[jt->id & ~1UL] = unitig->id;
-      unitig->transitive.insert(
-         nodes_[jt->id & ~1UL]->transitive.begin(),
-         nodes_[jt->id & ~1UL]->transitive.end());
-
-      if ((jt = jt->outedges.front()->head) == end) {
+      const auto& e = edges_[outedges(jt).front()];
+      marked_edges.emplace_back(e.id);
+      marked_edges.emplace_back(e.pair);
+      if ((jt = e.head) == end) {
         break;
       }
     }
   }
 
-  nodes_.insert(nodes_.end(), unitigs.begin(), unitigs.end());
-  edges_.insert(edges_.end(), unitig_edges.begin(), unitig_edges.end());
   RemoveEdges(marked_edges, true);
+  CompactAdjacency();
+
+  ParallelFor(nodes_.size(), kNodeBatchSize,  // update transitive edges
+      [&] (std::uint32_t first, std::uint32_t last) -> void {
+        for (std::uint32_t i = first; i < last; ++i) {
+          auto& it = nodes_[i];
+          if (it.is_removed ||
+              std::none_of(it.transitive.begin(), it.transitive.end(),
+                  [&] (std::uint32_t n) -> bool { return node_updates[n] != 0; })) {  // NOLINT
+            continue;
+          }
+          FlatSet<std::uint32_t> valid;
+          for (auto jt : it.transitive) {
+            valid.emplace(node_updates[jt] == 0 ? jt : node_updates[jt]);
+          }
+          it.transitive.swap(valid);
+        }
+      });
 
-  for (const auto& it : nodes_) {  // update transitive edges
-    if (it) {
-      std::unordered_set<std::uint32_t> valid;
-      for (auto jt : it->transitive) {
-        valid.emplace(node_updates[jt] == 0 ? jt : node_updates[jt]);
-      }
-      it->transitive.swap(valid);
-    }
-  }
-
-  return unitigs.size() / 2;
+  return paths.size();
 }
 
 std::vector<std::unique_ptr<biosoup::Sequence>> Graph::GetUnitigs(
-    bool drop_unpolished) {
+    bool drop_unpolished,
+    std::vector<std::uint32_t>* ids) {
 
   CreateUnitigs();
 
@@ -1790,63 +3483,200 @@ std::vector<std::unique_ptr<biosoup::Sequence>> Graph::GetUnitigs(
 
   std::vector<std::unique_ptr<biosoup::Sequence>> dst;
   for (const auto& it : nodes_) {
-    if (it == nullptr || it->is_rc() || !it->is_unitig()) {
+    if (it.is_removed || it.is_rc() || !it.is_unitig()) {
       continue;
     }
-    if (drop_unpolished && !it->is_polished) {
+    if (drop_unpolished && !it.is_polished) {
       continue;
     }
 
-    std::string name = it->name +
-        " LN:i:" + std::to_string(it->data.size()) +
-        " RC:i:" + std::to_string(it->count) +
-        " XO:i:" + std::to_string(it->is_circular);
+    std::string name = it.name +
+        " LN:i:" + std::to_string(it.data.size()) +
+        " RC:i:" + std::to_string(it.count) +
+        " XO:i:" + std::to_string(it.is_circular);
+
+    dst.emplace_back(new biosoup::Sequence(name, it.data));
+    if (ids) {
+      ids->emplace_back(it.id);
+    }
+  }
+
+  return dst;
+}
+
+std::uint32_t Graph::AddNode(biosoup::Sequence& sequence) {
+  std::uint32_t id = nodes_.size();
+  nodes_.emplace_back(id, sequence);
+  sequence.ReverseAndComplement();
+  nodes_.emplace_back(id + 1, sequence);
+  nodes_[id].pair = id + 1;
+  nodes_[id + 1].pair = id;
+  return id;
+}
+
+Graph::Node Graph::MergePath(
+    std::uint32_t id,
+    std::uint32_t begin,
+    std::uint32_t end) const {
+  Node dst(id, begin == end);
+
+  std::size_t size = begin == end ? 0 : nodes_[end].data.size();
+  for (auto jt = begin; true;) {
+    const auto& e = edges_[outedges(jt).front()];
+    size += e.length;
+    if ((jt = e.head) == end) {
+      break;
+    }
+  }
+  dst.data.reserve(size);
 
-    dst.emplace_back(new biosoup::Sequence(name, it->data));
+  auto jt = begin;
+  while (true) {
+    const auto& e = edges_[outedges(jt).front()];
+    dst.data.append(nodes_[jt].data, 0, e.length);
+    dst.count += nodes_[jt].count;
+    if ((jt = e.head) == end) {
+      break;
+    }
+  }
+  if (begin != end) {
+    dst.data += nodes_[end].data;
+    dst.count += nodes_[end].count;
   }
 
+  dst.name = (dst.is_unitig() ? "Utg" : "Ctg") + std::to_string(id);
   return dst;
 }
 
-void Graph::RemoveEdges(
-    const std::unordered_set<std::uint32_t>& indices,
+std::uint32_t Graph::AddEdge(
+    std::uint32_t tail,
+    std::uint32_t head,
+    std::uint32_t length,
+    std::uint32_t length_pair) {
+
+  std::uint32_t id = edges_.size();
+  edges_.emplace_back(id, tail, head, length);
+  edges_.emplace_back(id + 1, nodes_[head].pair, nodes_[tail].pair, length_pair);  // NOLINT
+  edges_[id].pair = id + 1;
+  edges_[id + 1].pair = id;
+
+  for (std::uint32_t i = id; i < id + 2; ++i) {
+    Append(&nodes_[edges_[i].tail].outedges, i);
+    Append(&nodes_[edges_[i].head].inedges, i);
+  }
+
+  return id;
+}
+
+void Graph::Append(Slice* slice, std::uint32_t edge) {
+  if (slice->size == slice->capacity) {
+    std::uint32_t begin = adjacency_.size();
+    slice->capacity = std::max(2 * slice->capacity, 4U);
+    adjacency_.resize(begin + slice->capacity);
+    std::copy(
+        adjacency_.begin() + slice->begin,
+        adjacency_.begin() + slice->begin + slice->size,
+        adjacency_.begin() + begin);
+    adjacency_slack_ += slice->size;
+    slice->begin = begin;
+  }
+  adjacency_[slice->begin + slice->size++] = edge;
+}
+
+void Graph::CompactAdjacency() {
+  for (auto& it : nodes_) {
+    it.inedges = Slice();
+    it.outedges = Slice();
+  }
+  for (const auto& it : edges_) {
+    if (it.is_removed) {
+      continue;
+    }
+    ++nodes_[it.tail].outedges.capacity;
+    ++nodes_[it.head].inedges.capacity;
+  }
+
+  std::uint32_t begin = 0;
+  for (auto& it : nodes_) {
+    it.inedges.begin = begin;
+    begin += it.inedges.capacity;
+    it.outedges.begin = begin;
+    begin += it.outedges.capacity;
+  }
+
+  adjacency_.resize(begin);
+  adjacency_.shrink_to_fit();
+  adjacency_slack_ = 0;
+  for (const auto& it : edges_) {
+    if (it.is_removed) {
+      continue;
+    }
+    auto& out = nodes_[it.tail].outedges;
+    adjacency_[out.begin + out.size++] = it.id;
+    auto& in = nodes_[it.head].inedges;
+    adjacency_[in.begin + in.size++] = it.id;
+  }
+}
+
+std::vector<std::uint32_t> Graph::RemoveEdges(
+    std::vector<std::uint32_t>& indices,
     bool remove_nodes) {
 
-  auto erase_remove = [] (std::vector<Edge*>& edges, Edge* marked) -> void {
-    edges.erase(std::remove(edges.begin(), edges.end(), marked), edges.end());
-  };
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
 
-  std::unordered_set<std::uint32_t> node_indices;
+  std::vector<std::uint32_t> node_indices;
   for (auto i : indices) {
-    if (remove_nodes) {
-      node_indices.emplace(edges_[i]->tail->id);
-      node_indices.emplace(edges_[i]->head->id);
+    edges_[i].is_removed = true;
+    node_indices.emplace_back(edges_[i].tail);
+    node_indices.emplace_back(edges_[i].head);
+  }
+  std::sort(node_indices.begin(), node_indices.end());
+  node_indices.erase(
+      std::unique(node_indices.begin(), node_indices.end()),
+      node_indices.end());
+
+  auto is_removed = [&] (std::uint32_t i) -> bool {
+    return edges_[i].is_removed;
+  };
+  for (auto i : node_indices) {  // compact each list once
+    for (auto slice : {&nodes_[i].inedges, &nodes_[i].outedges}) {
+      auto first = adjacency_.begin() + slice->begin;
+      auto last = first + slice->size;
+      slice->size = std::remove_if(first, last, is_removed) - first;
     }
-    erase_remove(edges_[i]->tail->outedges, edges_[i].get());
-    erase_remove(edges_[i]->head->inedges, edges_[i].get());
   }
+  adjacency_slack_ += 2 * indices.size();
+
   if (remove_nodes) {
     for (auto i : node_indices) {
-      if (nodes_[i]->outdegree() == 0 && nodes_[i]->indegree() == 0) {
-        nodes_[i].reset();
+      auto& node = nodes_[i];
+      if (node.outdegree() == 0 && node.indegree() == 0) {
+        node.is_removed = true;
+        std::string().swap(node.name);
+        std::string().swap(node.data);
+        node.transitive.clear();
       }
     }
   }
-  for (auto i : indices) {
-    edges_[i].reset();
+
+  if (adjacency_slack_ > adjacency_.size() / 2) {
+    CompactAdjacency();
   }
+
+  return node_indices;
 }
 
-std::unordered_set<std::uint32_t> Graph::FindRemovableEdges(
-    const std::vector<Node*>& path) {
+std::vector<std::uint32_t> Graph::FindRemovableEdges(
+    const std::vector<std::uint32_t>& path) {
   if (path.empty()) {
-    return std::unordered_set<std::uint32_t>{};
+    return std::vector<std::uint32_t>{};
   }
 
-  auto find_edge = [] (Node* tail, Node* head) -> Edge* {
-    for (auto it : tail->outedges) {
-      if (it->head == head) {
-        return it;
+  auto find_edge = [&] (std::uint32_t tail, std::uint32_t head) -> const Edge* {
+    for (auto it : outedges(tail)) {
+      if (edges_[it].head == head) {
+        return &edges_[it];
       }
     }
     return nullptr;
@@ -1855,7 +3685,7 @@ std::unordered_set<std::uint32_t> Graph::FindRemovableEdges(
   // find first node with multiple in edges
   std::int32_t pref = -1;
   for (std::uint32_t i = 1; i < path.size() - 1; ++i) {
-    if (path[i]->indegree() > 1) {
+    if (nodes_[path[i]].indegree() > 1) {
       pref = i;
       break;
     }
@@ -1864,45 +3694,45 @@ std::unordered_set<std::uint32_t> Graph::FindRemovableEdges(
   // find last node with multiple out edges
   std::int32_t suff = -1;
   for (std::uint32_t i = 1; i < path.size() - 1; ++i) {
-    if (path[i]->outdegree() > 1) {
+    if (nodes_[path[i]].outdegree() > 1) {
       suff = i;
     }
   }
 
-  std::unordered_set<std::uint32_t> dst;
+  std::vector<std::uint32_t> dst;
   if (pref == -1 && suff == -1) {  // remove whole path
     for (std::uint32_t i = 0; i < path.size() - 1; ++i) {
       auto it = find_edge(path[i], path[i + 1]);
-      dst.emplace(it->id);
-      dst.emplace(it->pair->id);
+      dst.emplace_back(it->id);
+      dst.emplace_back(it->pair);
     }
     return dst;
   }
 
-  if (pref != -1 && path[pref]->outdegree() > 1) {  // complex path
+  if (pref != -1 && nodes_[path[pref]].outdegree() > 1) {  // complex path
     return dst;  // empty
   }
-  if (suff != -1 && path[suff]->indegree() > 1) {  // complex path
+  if (suff != -1 && nodes_[path[suff]].indegree() > 1) {  // complex path
     return dst;  // empty
   }
 
   if (pref == -1) {  // remove everything after last suffix node
     for (std::uint32_t i = suff; i < path.size() - 1; ++i) {
       auto it = find_edge(path[i], path[i + 1]);
-      dst.emplace(it->id);
-      dst.emplace(it->pair->id);
+      dst.emplace_back(it->id);
+      dst.emplace_back(it->pair);
     }
   } else if (suff == -1) {  // remove everything before first prefix node
     for (std::int32_t i = 0; i < pref; ++i) {
       auto it = find_edge(path[i], path[i + 1]);
-      dst.emplace(it->id);
-      dst.emplace(it->pair->id);
+      dst.emplace_back(it->id);
+      dst.emplace_back(it->pair);
     }
   } else if (suff < pref) {  // remove everything in between
     for (std::int32_t i = suff; i < pref; ++i) {
       auto it = find_edge(path[i], path[i + 1]);
-      dst.emplace(it->id);
-      dst.emplace(it->pair->id);
+      dst.emplace_back(it->id);
+      dst.emplace_back(it->pair);
     }
   }
   return dst;  // empty
@@ -1930,46 +3760,48 @@ void Graph::PrintCSV(const std::string& path) const {
 
   std::ofstream os(path);
   for (const auto& it : nodes_) {
-    if ((it == nullptr) || it->is_rc() ||
-        (it->count == 1 && it->outdegree() == 0 && it->indegree() == 0)) {
+    if (it.is_removed || it.is_rc() ||
+        (it.count == 1 && it.outdegree() == 0 && it.indegree() == 0)) {
       continue;
     }
-    os << it->id << " [" << it->id / 2 << "]"
-       << " LN:i:" << it->data.size()
-       << " RC:i:" << it->count
+    os << it.id << " [" << it.id / 2 << "]"
+       << " LN:i:" << it.data.size()
+       << " RC:i:" << it.count
        << ","
-       << it->pair->id << " [" << it->pair->id / 2 << "]"
-       << " LN:i:" << it->pair->data.size()
-       << " RC:i:" << it->pair->count
+       << it.pair << " [" << it.pair / 2 << "]"
+       << " LN:i:" << nodes_[it.pair].data.size()
+       << " RC:i:" << nodes_[it.pair].count
        << ",0,-"
        << std::endl;
   }
   for (const auto& it : edges_) {
-    if (it == nullptr) {
+    if (it.is_removed) {
       continue;
     }
-    os << it->tail->id << " [" << it->tail->id / 2 << "]"
-       << " LN:i:" << it->tail->data.size()
-       << " RC:i:" << it->tail->count
+    const auto& tail = nodes_[it.tail];
+    const auto& head = nodes_[it.head];
+    os << tail.id << " [" << tail.id / 2 << "]"
+       << " LN:i:" << tail.data.size()
+       << " RC:i:" << tail.count
        << ","
-       << it->head->id << " [" << it->head->id / 2 << "]"
-       << " LN:i:" << it->head->data.size()
-       << " RC:i:" << it->head->count
+       << head.id << " [" << head.id / 2 << "]"
+       << " LN:i:" << head.data.size()
+       << " RC:i:" << head.count
        << ",1,"
-       << it->id << " " << it->length << " " << it->weight
+       << it.id << " " << it.length << " " << it.weight
        << std::endl;
   }
   for (const auto& it : nodes_) {  // circular edges TODO(rvaser): check
-    if (it == nullptr || !it->is_circular) {
+    if (it.is_removed || !it.is_circular) {
       continue;
     }
-    os << it->id << " [" << it->id / 2 << "]"
-       << " LN:i:" << it->data.size()
-       << " RC:i:" << it->count
+    os << it.id << " [" << it.id / 2 << "]"
+       << " LN:i:" << it.data.size()
+       << " RC:i:" << it.count
        << ","
-       << it->id << " [" << it->id / 2 << "]"
-       << " LN:i:" << it->data.size()
-       << " RC:i:" << it->count
+       << it.id << " [" << it.id / 2 << "]"
+       << " LN:i:" << it.data.size()
+       << " RC:i:" << it.count
        << ",1,-"
        << std::endl;
   }
@@ -1983,29 +3815,31 @@ void Graph::PrintGFA(const std::string& path) const {
 
   std::ofstream os(path);
   for (const auto& it : nodes_) {
-    if ((it == nullptr) || it->is_rc() ||
-        (it->count == 1 && it->outdegree() == 0 && it->indegree() == 0)) {
+    if (it.is_removed || it.is_rc() ||
+        (it.count == 1 && it.outdegree() == 0 && it.indegree() == 0)) {
       continue;
     }
-    os << "S\t" << it->name
-       << "\t"  << it->data
-       << "\tLN:i:" << it->data.size()
-       << "\tRC:i:" << it->count
+    os << "S\t" << it.name
+       << "\t"  << it.data
+       << "\tLN:i:" << it.data.size()
+       << "\tRC:i:" << it.count
        << std::endl;
-    if (it->is_circular) {
-      os << "L\t" << it->name << "\t" << '+'
-         << "\t"  << it->name << "\t" << '+'
+    if (it.is_circular) {
+      os << "L\t" << it.name << "\t" << '+'
+         << "\t"  << it.name << "\t" << '+'
          << "\t0M"
          << std::endl;
     }
   }
   for (const auto& it : edges_) {
-    if (it == nullptr) {
+    if (it.is_removed) {
       continue;
     }
-    os << "L\t" << it->tail->name << "\t" << (it->tail->is_rc() ? '-' : '+')
-       << "\t"  << it->head->name << "\t" << (it->head->is_rc() ? '-' : '+')
-       << "\t"  << it->tail->data.size() - it->length << 'M'
+    const auto& tail = nodes_[it.tail];
+    const auto& head = nodes_[it.head];
+    os << "L\t" << tail.name << "\t" << (tail.is_rc() ? '-' : '+')
+       << "\t"  << head.name << "\t" << (head.is_rc() ? '-' : '+')
+       << "\t"  << tail.data.size() - it.length << 'M'
        << std::endl;
   }
   os.close();
@@ -2015,22 +3849,101 @@ void Graph::Store() const {
   std::ofstream os("raven.cereal");
   try {
     cereal::BinaryOutputArchive archive(os);
-    archive(*this);
+    archive(kArchiveVersion, *this);
   } catch (std::exception&) {
     throw std::logic_error(
         "[raven::Graph::Store] error: unable to store archive");
   }
 }
 
+void Graph::StoreShard(
+    std::uint32_t shard,
+    const std::vector<std::vector<biosoup::Overlap>>& overlaps) const {
+
+  std::vector<std::uint32_t> data;  // flattened overlaps
+  for (const auto& it : overlaps) {
+    for (const auto& jt : it) {
+      data.emplace_back(jt.lhs_id);
+      data.emplace_back(jt.lhs_begin);
+      data.emplace_back(jt.lhs_end);
+      data.emplace_back(jt.rhs_id);
+      data.emplace_back(jt.rhs_begin);
+      data.emplace_back(jt.rhs_end);
+      data.emplace_back(jt.score);
+      data.emplace_back(jt.strand);
+    }
+  }
+
+  std::ofstream os("raven.shard" + std::to_string(shard) + ".cereal");
+  try {
+    cereal::BinaryOutputArchive archive(os);
+    archive(kArchiveVersion, piles_, data);
+  } catch (std::exception&) {
+    throw std::logic_error(
+        "[raven::Graph::StoreShard] error: unable to store archive");
+  }
+}
+
+void Graph::LoadShard(
+    std::uint32_t shard,
+    std::vector<std::vector<biosoup::Overlap>>& overlaps) {
+
+  std::vector<std::unique_ptr<Pile>> piles;
+  std::vector<std::uint32_t> data;
+
+  std::uint32_t version = 0;
+  std::ifstream is("raven.shard" + std::to_string(shard) + ".cereal");
+  try {
+    cereal::BinaryInputArchive archive(is);
+    archive(version);
+    if (version == kArchiveVersion) {
+      archive(piles, data);
+    }
+  } catch (std::exception&) {
+    throw std::logic_error(
+        "[raven::Graph::LoadShard] error: unable to load archive");
+  }
+  if (version != kArchiveVersion) {
+    throw std::logic_error(
+        "[raven::Graph::LoadShard] error: archive of a different version");
+  }
+  bool is_valid = piles.size() == piles_.size() && data.size() % 8 == 0;
+  for (std::uint32_t i = 0; is_valid && i < data.size(); i += 8) {
+    is_valid = data[i] < overlaps.size() && data[i + 3] < overlaps.size();
+  }
+  if (!is_valid) {
+    throw std::logic_error(
+        "[raven::Graph::LoadShard] error: shard of a different sequence set");
+  }
+
+  for (std::uint32_t i = 0; i < piles.size(); ++i) {
+    piles_[i]->Merge(*(piles[i].get()));
+  }
+  for (std::uint32_t i = 0; i < data.size(); i += 8) {
+    overlaps[data[i]].emplace_back(
+        data[i], data[i + 1], data[i + 2],
+        data[i + 3], data[i + 4], data[i + 5],
+        data[i + 6], data[i + 7]);
+  }
+}
+
 void Graph::Load() {
+  std::uint32_t version = 0;
   std::ifstream is("raven.cereal");
   try {
     cereal::BinaryInputArchive archive(is);
-    archive(*this);
+    archive(version);
+    if (version == kArchiveVersion) {
+      archive(*this);
+    }
   } catch (std::exception&) {
     throw std::logic_error(
         "[raven::Graph::Load] error: unable to load archive");
   }
+  if (version != kArchiveVersion) {
+    throw std::logic_error(
+        "[raven::Graph::Load] error: archive of a different version");
+  }
 }
 
 }  // namespace raven
@@ -3,31 +3,64 @@
 #ifndef RAVEN_GRAPH_HPP_
 #define RAVEN_GRAPH_HPP_
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <string>
 #include <memory>
+#include <queue>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 
 #include <iostream>
 
+#include "bioparser/parser.hpp"
 #include "biosoup/sequence.hpp"
 #include "cereal/access.hpp"
 #include "cereal/types/memory.hpp"
 #include "cereal/types/string.hpp"
-#include "cereal/types/unordered_set.hpp"
 #include "cereal/types/vector.hpp"
 #include "ram/minimizer_engine.hpp"
 #include "thread_pool/thread_pool.hpp"
 
+#include "flat_set.hpp"
 #include "pile.hpp"
 
 namespace raven {
 
+namespace test {
+class GraphTest;
+}  // namespace test
+
+struct MinimizerParameters {
+ public:
+  MinimizerParameters(std::uint32_t k, std::uint32_t w, double frequency)
+      : k(k),
+        w(w),
+        frequency(frequency) {}
+
+  std::uint32_t k;
+  std::uint32_t w;
+  double frequency;  // of most frequent minimizers to ignore
+};
+
+// how long edges leaving junctions are found
+enum class LongEdgeMode {
+  kLayout,  // compare lengths in force directed layout
+  kNeighbourhood,  // compare numbers of neighbours shared by edge ends
+  kCompare  // remove by layout and count decisions shared with neighbourhood
+};
+
 class Graph {
  public:
-  explicit Graph(std::shared_ptr<thread_pool::ThreadPool> thread_pool = nullptr);  // NOLINT
+  // (numa = interleave minimizer indices across NUMA nodes)
+  explicit Graph(
+      std::shared_ptr<thread_pool::ThreadPool> thread_pool = nullptr,
+      bool numa = false);
 
   Graph(const Graph&) = delete;
   Graph& operator=(const Graph&) = delete;
@@ -43,14 +76,50 @@ class Graph {
 
   // break chimeric sequences, remove contained sequences and overlaps not
   // spanning bridged repeats at sequence ends
-  void Construct(std::vector<std::unique_ptr<biosoup::Sequence>>& sequences);  // NOLINT
+  // (hpc = seed overlaps with homopolymer compressed sequences,
+  //  coarse = minimizers for overlaps used to annotate piles,
+  //  sensitive = minimizers for overlaps between valid sequences,
+  //  invalid_frequency = filter used when mapping invalid sequences,
+  //  tune = pick k and w for both stages on a sample of sequences,
+  //  coverage = keep longest and most accurate sequences up to the given
+  //  coverage of the estimated genome size (0 keeps all),
+  //  num_shards & shard = only index the given slice of sequences in coarse
+  //  overlap stage and store partial piles and overlaps, or merge them from
+  //  all shards and continue if shard is negative)
+  void Construct(
+      std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,  // NOLINT
+      bool hpc = false,
+      MinimizerParameters coarse = MinimizerParameters(15, 5, 0.001),
+      MinimizerParameters sensitive = MinimizerParameters(15, 5, 0.001),
+      double invalid_frequency = 0.00001,
+      bool tune = false,
+      double coverage = 0,
+      std::uint32_t num_shards = 0,
+      std::int32_t shard = -1);
 
   // simplify with transitive reduction, tip prunning and bubble popping
-  void Assemble();
+  // (long_edges = how long edges are found before final simplification)
+  void Assemble(LongEdgeMode long_edges = LongEdgeMode::kLayout);
 
-  // Racon wrapper
+  // Racon wrapper, unitigs that stop changing are left out of later rounds
+  // together with sequences mapping only to them
   void Polish(
-      const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+      std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,  // NOLINT
+      double quality,  // average Phred quality of sequences (0 without)
+      std::uint8_t match,
+      std::uint8_t mismatch,
+      std::uint8_t gap,
+      std::uint32_t cuda_poa_batches,
+      bool cuda_banded_alignment,
+      std::uint32_t cuda_alignment_batches,
+      std::uint32_t num_rounds);
+
+  // streams sequences from sparser in chunks of chunk_size bytes instead,
+  // keeping at most about that much of them in memory per racon invocation,
+  // sequences of each batch are spilled to a file once per round
+  void Polish(
+      bioparser::Parser<biosoup::Sequence>* sparser,
+      std::uint64_t chunk_size,
       std::uint8_t match,
       std::uint8_t mismatch,
       std::uint8_t gap,
@@ -62,8 +131,10 @@ class Graph {
   // ignore nodes that are less than epsilon away from any junction node
   std::uint32_t CreateUnitigs(std::uint32_t epsilon = 0);
 
+  // (ids = filled with the node of each unitig)
   std::vector<std::unique_ptr<biosoup::Sequence>> GetUnitigs(
-      bool drop_unpolished = false);
+      bool drop_unpolished = false,
+      std::vector<std::uint32_t>* ids = nullptr);
 
   // draw with misc/plotter.py
   void PrintJSON(const std::string& path) const;
@@ -81,15 +152,94 @@ class Graph {
   void Store() const;
 
  private:
+  friend class test::GraphTest;
+
+  // first sequence of a shard given prefix sums of sequence lengths, each
+  // sequence is mapped onto all indexed ones with a lower index, so
+  // boundaries follow the square root to split work evenly
+  static std::uint32_t ShardBoundary(
+      const std::vector<std::uint64_t>& num_bytes,
+      std::uint32_t shard,
+      std::uint32_t num_shards);
+
+  // count distinct solid k-mers with an adaptively subsampled sketch, k is
+  // kept apart from minimizer lengths as short k-mers saturate large genomes
+  std::uint64_t EstimateGenomeSize(
+      const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+      std::uint32_t k = 21);
+
+  // pick k and w which find most overlaps with sparsest seeds on a sample
+  std::pair<std::uint32_t, std::uint32_t> TuneMinimizers(
+      const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+      MinimizerParameters parameters);
+
+  // cereal store wrapper for partial results of sharded construction
+  void StoreShard(
+      std::uint32_t shard,
+      const std::vector<std::vector<biosoup::Overlap>>& overlaps) const;
+
+  // cereal load wrapper which merges partial results into piles and overlaps
+  void LoadShard(
+      std::uint32_t shard,
+      std::vector<std::vector<biosoup::Overlap>>& overlaps);  // NOLINT
+
   // inspired by (Myers 1995) & (Myers 2005)
   std::uint32_t RemoveTransitiveEdges();
 
+  class Worklist;
+
   std::uint32_t RemoveTips();
 
   std::uint32_t RemoveBubbles();
 
-  // remove long edges in force directed layout
-  std::uint32_t RemoveLongEdges(std::uint32_t num_round);
+  // visit nodes queued in tips and notify both worklists about deletions
+  std::uint32_t RemoveTips(Worklist* tips, Worklist* bubbles);
+
+  struct Tip;
+
+  // walk from begin over unbranched nodes and find edges which detach the
+  // walk or its end from the rest of the graph
+  Tip FindTip(std::uint32_t begin) const;
+
+  // visit nodes queued in bubbles and notify both worklists about deletions
+  std::uint32_t RemoveBubbles(Worklist* bubbles, Worklist* tips);
+
+  // find superbubbles (entrance, exit) of the acyclic part of the graph in
+  // linear time, inner superbubbles precede outer ones
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> FindSuperbubbles() const;  // NOLINT
+
+  // pop bubbles inside superbubbles from the innermost out, returns number
+  // of popped bubbles
+  std::uint32_t RemoveSuperbubbles(
+      const std::vector<std::pair<std::uint32_t, std::uint32_t>>& superbubbles);  // NOLINT
+
+  // repeat tip and bubble removal until nothing changes, after the first
+  // sweep only nodes whose search touched deleted edges are revisited
+  std::uint32_t RemoveTipsAndBubbles();
+
+  // remove long edges in force directed layout or by shared neighbours,
+  // compare mode removes by layout and adds numbers of edges found by
+  // layout, by neighbourhood and by both in each round to agreement
+  std::uint32_t RemoveLongEdges(
+      std::uint32_t num_rounds,
+      LongEdgeMode mode = LongEdgeMode::kLayout,
+      std::array<std::uint32_t, 3>* agreement = nullptr);
+
+  // mark out edges of junctions which outweigh a sibling more than twice
+  std::vector<std::uint32_t> FindLongEdges() const;
+
+  // weigh out edges of junctions inversely to the number of neighbours their
+  // ends share over other in, out and transitive edges, ends which are close
+  // in force directed layout share most
+  void CreateNeighbourhoodWeights();
+
+  // store polished unitigs of nodes in ids (racon keeps the order of
+  // targets) and return the ones which changed by at least one edit per
+  // 10 kbp, ids are shrunk alike and edits are added to drift (per node)
+  std::vector<std::unique_ptr<biosoup::Sequence>> StoreUnitigs(
+      std::vector<std::unique_ptr<biosoup::Sequence>>* polished,
+      std::vector<std::uint32_t>* ids,
+      std::vector<std::uint64_t>* drift = nullptr);
 
   friend cereal::access;
 
@@ -97,60 +247,34 @@ class Graph {
 
   template<class Archive>
   void save(Archive& archive) const {  // NOLINT
-    std::vector<std::pair<std::uint32_t, std::uint32_t>> connections;
-    for (const auto& it : edges_) {
-      if (it && !it->is_rc()) {
-        connections.emplace_back(it->tail->id, it->head->id);
-      } else {
-        connections.emplace_back();  // dummy
-      }
-    }
-
-    archive(stage_, piles_, nodes_, edges_, connections);
+    archive(stage_, piles_, nodes_, edges_);
   }
 
   template<class Archive>
   void load(Archive& archive) {  // NOLINT
-    std::vector<std::pair<std::uint32_t, std::uint32_t>> connections;
-
-    archive(stage_, piles_, nodes_, edges_, connections);
-
-    for (std::uint32_t i = 0; i < nodes_.size(); i += 2) {
-      if (nodes_[i]) {
-        nodes_[i]->pair = nodes_[i + 1].get();
-        nodes_[i + 1]->pair = nodes_[i].get();
-      }
-    }
-    for (std::uint32_t i = 0; i < edges_.size(); i += 2) {
-      if (edges_[i]) {
-        edges_[i]->pair = edges_[i + 1].get();
-        edges_[i + 1]->pair = edges_[i].get();
-
-        edges_[i]->tail = nodes_[connections[i].first].get();
-        edges_[i]->head = nodes_[connections[i].second].get();
-        edges_[i + 1]->head = edges_[i]->tail->pair;
-        edges_[i + 1]->tail = edges_[i]->head->pair;
-
-        edges_[i]->tail->outedges.emplace_back(edges_[i].get());
-        edges_[i]->head->inedges.emplace_back(edges_[i].get());
-        edges_[i + 1]->tail->outedges.emplace_back(edges_[i + 1].get());
-        edges_[i + 1]->head->inedges.emplace_back(edges_[i + 1].get());
-      }
-    }
-
-    Node::num_objects = nodes_.size();
-    Edge::num_objects = edges_.size();
+    archive(stage_, piles_, nodes_, edges_);
+    CompactAdjacency();
   }
 
-  struct Node;
-  struct Edge;
+  // position of edge ids in adjacency array, room after size is free
+  struct Slice {
+   public:
+    Slice()
+        : begin(0),
+          size(0),
+          capacity(0) {}
+
+    std::uint32_t begin;
+    std::uint32_t size;
+    std::uint32_t capacity;
+  };
 
   struct Node {
    public:
     Node() = default;  // needed for cereal
 
-    explicit Node(const biosoup::Sequence& sequence);
-    Node(Node* begin, Node* end);
+    Node(std::uint32_t id, const biosoup::Sequence& sequence);
+    Node(std::uint32_t id, bool is_circular);
 
     Node(const Node&) = delete;
     Node& operator=(const Node&) = delete;
@@ -161,10 +285,10 @@ class Graph {
     ~Node() = default;
 
     std::uint32_t indegree() const {
-      return inedges.size();
+      return inedges.size;
     }
     std::uint32_t outdegree() const {
-      return outedges.size();
+      return outedges.size;
     }
 
     bool is_rc() const {
@@ -182,74 +306,232 @@ class Graph {
 
     template<class Archive>
     void serialize(Archive& archive) {  // NOLINT
-      archive(id, name, data, count, is_circular, is_polished, transitive);
+      archive(id, name, data, count, is_circular, is_polished, is_removed,
+          transitive, pair);
     }
 
-    static std::atomic<std::uint32_t> num_objects;
-
     std::uint32_t id;
     std::string name;
     std::string data;
     std::uint32_t count;
     bool is_circular;
     bool is_polished;
-    std::unordered_set<std::uint32_t> transitive;
-    std::vector<Edge*> inedges;
-    std::vector<Edge*> outedges;
-    Node* pair;
+    bool is_removed;
+    FlatSet<std::uint32_t> transitive;
+    std::uint32_t pair;
+    Slice inedges;
+    Slice outedges;
   };
   struct Edge {
    public:
     Edge() = default;  // needed for cereal
 
-    Edge(Node* tail, Node* head, std::uint32_t length);
-
-    Edge(const Edge&) = delete;
-    Edge& operator=(const Edge&) = delete;
-
-    ~Edge() = default;
+    Edge(
+        std::uint32_t id,
+        std::uint32_t tail,
+        std::uint32_t head,
+        std::uint32_t length);
 
     bool is_rc() const {
       return id & 1;
     }
 
-    std::string Label() const {
-      return tail->data.substr(0, length);
-    }
-
     template<class Archive>
     void serialize(Archive& archive) {  // NOLINT
-      archive(id, length, weight);
+      archive(id, length, weight, is_removed, tail, head, pair);
     }
 
-    static std::atomic<std::uint32_t> num_objects;
-
     std::uint32_t id;
     std::uint32_t length;
     double weight;
-    Node* tail;
-    Node* head;
-    Edge* pair;
+    bool is_removed;
+    std::uint32_t tail;
+    std::uint32_t head;
+    std::uint32_t pair;
+  };
+
+  // read-only view of a node's edge ids
+  struct EdgeList {
+   public:
+    EdgeList(const std::uint32_t* first, const std::uint32_t* last)
+        : first(first),
+          last(last) {}
+
+    const std::uint32_t* begin() const {
+      return first;
+    }
+    const std::uint32_t* end() const {
+      return last;
+    }
+    std::uint32_t size() const {
+      return last - first;
+    }
+    std::uint32_t front() const {
+      return *first;
+    }
+    std::uint32_t operator[](std::uint32_t i) const {
+      return first[i];
+    }
+
+    const std::uint32_t* first;
+    const std::uint32_t* last;
   };
 
-  std::unordered_set<std::uint32_t> FindRemovableEdges(
-      const std::vector<Node*>& path);
+  // views are invalidated by AddEdge and CompactAdjacency
+  EdgeList inedges(std::uint32_t node) const {
+    const auto& s = nodes_[node].inedges;
+    return EdgeList(adjacency_.data() + s.begin, adjacency_.data() + s.begin + s.size);  // NOLINT
+  }
+  EdgeList outedges(std::uint32_t node) const {
+    const auto& s = nodes_[node].outedges;
+    return EdgeList(adjacency_.data() + s.begin, adjacency_.data() + s.begin + s.size);  // NOLINT
+  }
 
-  void RemoveEdges(
-      const std::unordered_set<std::uint32_t>& indices,
+  std::string Label(const Edge& edge) const {
+    return nodes_[edge.tail].data.substr(0, edge.length);
+  }
+
+  // create node and its reverse complement, returns id of the former
+  // (sequence is left reverse complemented)
+  std::uint32_t AddNode(biosoup::Sequence& sequence);  // NOLINT
+
+  // node of given id merging the path from begin to end (both inclusive),
+  // or the cycle through begin if both are equal, with sequence allocated
+  // once
+  Node MergePath(std::uint32_t id, std::uint32_t begin, std::uint32_t end) const;  // NOLINT
+
+  // create edge and its pair from the reverse complement strand, returns id
+  // of the former
+  std::uint32_t AddEdge(
+      std::uint32_t tail,
+      std::uint32_t head,
+      std::uint32_t length,
+      std::uint32_t length_pair);
+
+  // append to slice, moving it to the back of adjacency array when full
+  void Append(Slice* slice, std::uint32_t edge);
+
+  // lay out adjacency of live edges contiguously, ordered by edge id
+  void CompactAdjacency();
+
+  std::vector<std::uint32_t> FindRemovableEdges(
+      const std::vector<std::uint32_t>& path);
+
+  // paths with common ends which are disjoint and similar enough to merge,
+  // sequences of paths with branches are compared through views of node data
+  bool IsBubble(
+      const std::vector<std::uint32_t>& lhs,
+      const std::vector<std::uint32_t>& rhs);
+
+  // BFS from begin which does not expand exit until two paths meet, returns
+  // edges of the path with fewer sequences if the paths form a bubble
+  // (distance and predecessor are reset scratch arrays, visited = nodes the
+  //  search depended on)
+  std::vector<std::uint32_t> FindBubble(
+      std::uint32_t begin,
+      std::uint32_t exit,
+      std::vector<std::uint32_t>* distance,
+      std::vector<std::uint32_t>* predecessor,
+      std::vector<std::uint32_t>* visited);
+
+  // mark edges as removed and compact adjacency of their nodes once, returns
+  // ids of those nodes
+  // (indices are sorted and deduplicated in place, remove_nodes = also remove
+  //  nodes left without edges)
+  std::vector<std::uint32_t> RemoveEdges(
+      std::vector<std::uint32_t>& indices,  // NOLINT
       bool remove_nodes = false);
 
+  struct Tip {
+   public:
+    std::uint32_t end;  // last node before a junction
+    bool is_whole;  // walk is removed, otherwise only edges of its end
+    std::vector<std::uint32_t> walk;  // marked visited with pairs
+    std::vector<std::uint32_t> watched;  // nodes which decide the tip
+    std::vector<std::uint32_t> marked_edges;
+  };
+
+  // run f(first, last) over chunks of [0, size) in the thread pool and wait,
+  // chunks are at most batch_size long and at least four per thread
+  template<class F>
+  void ParallelFor(std::uint32_t size, std::uint32_t batch_size, const F& f) {
+    std::uint32_t num_chunks = 4 * thread_pool_->num_threads();
+    std::uint32_t chunk_size = std::max(1U, std::min(
+        batch_size, (size + num_chunks - 1) / num_chunks));
+
+    std::vector<std::future<void>> thread_futures;
+    for (std::uint32_t i = 0; i < size; i += chunk_size) {
+      thread_futures.emplace_back(thread_pool_->Submit(
+          f, i, std::min(i + chunk_size, size)));
+    }
+    for (const auto& it : thread_futures) {
+      it.wait();
+    }
+  }
+
+  // nodes a simplification pass has to visit in ascending order, nodes pushed
+  // during the pass are visited in the same pass if they come after the
+  // current one and in the next pass otherwise
+  class Worklist {
+   public:
+    explicit Worklist(std::uint32_t num_nodes);  // with all nodes
+
+    void Start();
+
+    bool Next(std::uint32_t* i);
+
+    void Push(std::uint32_t i);
+
+    const std::vector<std::uint32_t>& pending() const {  // next pass
+      return pending_;
+    }
+
+    // push i once adjacency of any of given nodes changes
+    void Watch(std::uint32_t i, const std::vector<std::uint32_t>& nodes);
+
+    // push given nodes and nodes watching them
+    void Notify(const std::vector<std::uint32_t>& nodes);
+
+   private:
+    bool is_running_;
+    std::uint32_t position_;
+    std::vector<char> is_pending_;
+    std::vector<std::uint32_t> pending_;
+    std::vector<char> is_current_;
+    std::vector<std::vector<std::uint32_t>> watchers_;
+    std::priority_queue<
+        std::uint32_t,
+        std::vector<std::uint32_t>,
+        std::greater<std::uint32_t>> current_;
+  };
+
   // use (Fruchterman & Reingold 1991) with (Barnes & Hut 1986) approximation
-  // (draw with misc/plotter.py)
-  void CreateForceDirectedLayout(const std::string& path = "");
+  // and coarsening of large components, components with all nodes in
+  // positions are only refined, positions are updated (draw with
+  // misc/plotter.py)
+  void CreateForceDirectedLayout(
+      const std::string& path = "",
+      std::vector<std::pair<double, double>>* positions = nullptr);
 
   std::shared_ptr<thread_pool::ThreadPool> thread_pool_;
+  bool numa_;
   ram::MinimizerEngine minimizer_engine_;
 
   int stage_;
   std::vector<std::unique_ptr<Pile>> piles_;
-  std::vector<std::shared_ptr<Node>> nodes_;
-  std::vector<std::shared_ptr<Edge>> edges_;
+  std::vector<Node> nodes_;  // indexed by id, pairs are adjacent
+  std::vector<Edge> edges_;  // indexed by id, pairs are adjacent
+  std::vector<std::uint32_t> adjacency_;  // edge ids sliced per node
+  std::size_t adjacency_slack_;  // unused entries, compacted past a half
+  // last bubble paths compared per pair of bubble ends (begin << 32 | end)
+  // during simplification, node ids are never reused so results hold until
+  // polishing
+  struct PathSimilarity {
+    std::vector<std::uint32_t> first;
+    std::vector<std::uint32_t> second;
+    bool is_similar;
+  };
+  std::unordered_map<std::uint64_t, PathSimilarity> path_similarities_;
 };
 
 }  // namespace raven
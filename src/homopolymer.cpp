@@ -0,0 +1,81 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "homopolymer.hpp"
+
+#include <future>
+
+namespace raven {
+
+std::vector<std::unique_ptr<biosoup::Sequence>> HomopolymerCompressor::Compress(  // NOLINT
+    const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool) {
+
+  std::vector<std::unique_ptr<biosoup::Sequence>> dst(sequences.size());
+  data_.assign(sequences.size(), nullptr);
+  samples_.assign(sequences.size(), std::vector<std::uint32_t>());
+
+  std::vector<std::future<void>> thread_futures;
+  for (std::uint32_t i = 0; i < sequences.size(); ++i) {
+    thread_futures.emplace_back(thread_pool->Submit(
+        [&] (std::uint32_t i) -> void {
+          const auto& data = sequences[i]->data;
+          auto id = sequences[i]->id;
+
+          dst[i] = std::unique_ptr<biosoup::Sequence>(new biosoup::Sequence());
+          dst[i]->id = id;
+          dst[i]->name = sequences[i]->name;
+
+          std::uint32_t num_runs = !data.empty();
+          for (std::uint32_t j = 1; j < data.size(); ++j) {
+            num_runs += data[j] != data[j - 1];
+          }
+          dst[i]->data.reserve(num_runs);
+
+          auto& samples = samples_[id];
+          samples.reserve((num_runs >> kHSS) + 1);
+
+          std::uint32_t c = 0;
+          for (std::uint32_t j = 0; j < data.size(); ++c) {
+            if ((c & ((1U << kHSS) - 1)) == 0) {
+              samples.emplace_back(j);
+            }
+            dst[i]->data += data[j];
+            for (++j; j < data.size() && data[j] == data[j - 1]; ++j) {
+            }
+          }
+          if ((c & ((1U << kHSS) - 1)) == 0) {
+            samples.emplace_back(data.size());
+          }
+          data_[id] = &data;
+        },
+        i));
+  }
+  for (const auto& it : thread_futures) {
+    it.wait();
+  }
+
+  return dst;
+}
+
+void HomopolymerCompressor::Decompress(biosoup::Overlap& o) const {
+  o.lhs_begin = Decompress(o.lhs_id, o.lhs_begin);
+  o.lhs_end = Decompress(o.lhs_id, o.lhs_end);
+  o.rhs_begin = Decompress(o.rhs_id, o.rhs_begin);
+  o.rhs_end = Decompress(o.rhs_id, o.rhs_end);
+}
+
+std::uint32_t HomopolymerCompressor::Decompress(
+    std::uint32_t id,
+    std::uint32_t position) const {
+  const auto& data = *data_[id];
+  std::uint32_t dst = samples_[id][position >> kHSS];
+  for (std::uint32_t i = 0; i < (position & ((1U << kHSS) - 1)); ++i) {
+    auto c = data[dst];
+    while (dst < data.size() && data[dst] == c) {
+      ++dst;
+    }
+  }
+  return dst;
+}
+
+}  // namespace raven
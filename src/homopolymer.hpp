@@ -0,0 +1,51 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAVEN_HOMOPOLYMER_HPP_
+#define RAVEN_HOMOPOLYMER_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "biosoup/overlap.hpp"
+#include "biosoup/sequence.hpp"
+#include "thread_pool/thread_pool.hpp"
+
+namespace raven {
+
+constexpr std::uint32_t kHSS = 4;  // sample every 2 ^ kHSS compressed bases
+
+// collapses runs of equal bases into a single base while keeping a sparse map
+// of compressed to original coordinates
+class HomopolymerCompressor {
+ public:
+  HomopolymerCompressor() = default;
+
+  HomopolymerCompressor(const HomopolymerCompressor&) = delete;
+  HomopolymerCompressor& operator=(const HomopolymerCompressor&) = delete;
+
+  HomopolymerCompressor(HomopolymerCompressor&&) = default;
+  HomopolymerCompressor& operator=(HomopolymerCompressor&&) = default;
+
+  ~HomopolymerCompressor() = default;
+
+  // create compressed copies with original ids (sequences have to outlive the
+  // compressor)
+  std::vector<std::unique_ptr<biosoup::Sequence>> Compress(
+      const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,
+      std::shared_ptr<thread_pool::ThreadPool> thread_pool);
+
+  // translate overlap between compressed sequences to original coordinates
+  void Decompress(biosoup::Overlap& o) const;  // NOLINT
+
+ private:
+  std::uint32_t Decompress(std::uint32_t id, std::uint32_t position) const;
+
+  std::vector<const std::string*> data_;
+  std::vector<std::vector<std::uint32_t>> samples_;
+};
+
+}  // namespace raven
+
+#endif  // RAVEN_HOMOPOLYMER_HPP_
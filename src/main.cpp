@@ -2,13 +2,19 @@
 
 #include <getopt.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
 
 #include "bioparser/fasta_parser.hpp"
 #include "bioparser/fastq_parser.hpp"
 #include "biosoup/timer.hpp"
 
+#include "affinity.hpp"
 #include "graph.hpp"
+#include "quality.hpp"
 
 std::atomic<std::uint32_t> biosoup::Sequence::num_objects{0};
 
@@ -21,11 +27,24 @@ static struct option options[] = {
   {"match", required_argument, nullptr, 'm'},
   {"mismatch", required_argument, nullptr, 'n'},
   {"gap", required_argument, nullptr, 'g'},
+  {"stream-polishing", required_argument, nullptr, 'P'},
 #ifdef CUDA_ENABLED
   {"cuda-poa-batches", optional_argument, nullptr, 'c'},
   {"cuda-banded-alignment", no_argument, nullptr, 'b'},
   {"cuda-alignment-batches", required_argument, nullptr, 'a'},
 #endif
+  {"kmer-len", required_argument, nullptr, 'k'},
+  {"window-len", required_argument, nullptr, 'w'},
+  {"frequency", required_argument, nullptr, 'F'},
+  {"auto-tune", no_argument, nullptr, 'T'},
+  {"homopolymer-compression", no_argument, nullptr, 'H'},
+  {"max-coverage", required_argument, nullptr, 'C'},
+  {"shard", required_argument, nullptr, 'S'},
+  {"merge-shards", required_argument, nullptr, 'M'},
+#ifdef NUMA_ENABLED
+  {"numa", no_argument, nullptr, 'N'},
+#endif
+  {"long-edges", required_argument, nullptr, 'L'},
   {"graphical-fragment-assembly", required_argument, nullptr, 'f'},
   {"resume", no_argument, nullptr, 'r'},
   {"threads", required_argument, nullptr, 't'},
@@ -34,6 +53,23 @@ static struct option options[] = {
   {nullptr, 0, nullptr, 0}
 };
 
+// returns an empty list if str is not a comma separated list of numbers
+std::vector<double> ParseList(const char* str) {
+  std::vector<double> dst;
+  while (true) {
+    char* end;
+    dst.emplace_back(std::strtod(str, &end));
+    if (end == str || (*end != ',' && *end != '\0')) {
+      return {};
+    }
+    if (*end == '\0') {
+      break;
+    }
+    str = end + 1;
+  }
+  return dst;
+}
+
 std::unique_ptr<bioparser::Parser<biosoup::Sequence>> CreateParser(
     const std::string& path) {
   auto is_suffix = [] (const std::string& s, const std::string& suff) {
@@ -73,7 +109,9 @@ void Help() {
       "\n"
       "  # default output is stdout\n"
       "  <sequences>\n"
-      "    input file in FASTA/FASTQ format (can be compressed with gzip)\n"
+      "    input file in FASTA/FASTQ format (can be compressed with gzip),\n"
+      "    qualities equal across all sequences (at any value) are dropped and\n"
+      "    racon then polishes with a quality threshold of 0\n"
       "\n"
       "  options:\n"
       "    -p, --polishing-rounds <int>\n"
@@ -88,6 +126,13 @@ void Help() {
       "    -g, --gap <int>\n"
       "      default: -4\n"
       "      gap penalty (must be negative)\n"
+      "    --stream-polishing <int>\n"
+      "      default: 0\n"
+      "      read sequences from the input file in chunks of given megabytes\n"
+      "      while polishing instead of keeping them in memory, racon is invoked\n"
+      "      on batches of unitigs whose sequences fit the same bound and are\n"
+      "      spilled to raven.batch*.cereal files once per round\n"
+      "      (0 keeps all sequences in memory)\n"
 #ifdef CUDA_ENABLED
       "    -c, --cuda-poa-batches <int>\n"
       "       default: 0\n"
@@ -99,10 +144,47 @@ void Help() {
       "       default: 0\n"
       "       number of batches for CUDA accelerated alignment\n"
 #endif
+      "    -k, --kmer-len <int>[,<int>]\n"
+      "      default: 15\n"
+      "      length of minimizers used to find coarse and sensitive overlaps\n"
+      "      (second value defaults to the first one)\n"
+      "    -w, --window-len <int>[,<int>]\n"
+      "      default: 5\n"
+      "      length of sliding window from which minimizers are sampled\n"
+      "      (second value defaults to the first one)\n"
+      "    --frequency <double>[,<double>[,<double>]]\n"
+      "      default: 0.001,0.001,0.00001\n"
+      "      threshold for ignoring most frequent minimizers\n"
+      "      (for coarse, sensitive and invalid sequence overlaps)\n"
+      "    --auto-tune\n"
+      "      pick k-mer and window lengths on a sample of sequences\n"
+      "      (overrides -k and -w)\n"
+      "    --homopolymer-compression\n"
+      "      find overlaps on homopolymer compressed sequences\n"
+      "    --max-coverage <double>\n"
+      "      construct the graph from longest and most accurate sequences up to\n"
+      "      given (positive) coverage of the estimated genome size (all\n"
+      "      sequences are used without it, polishing always uses them)\n"
+      "    --shard <int>,<int>\n"
+      "      map the i-th (0-based) of n slices of sequences and store partial\n"
+      "      piles and overlaps in the working directory\n"
+      "    --merge-shards <int>\n"
+      "      merge partial piles and overlaps of n shards and continue\n"
+#ifdef NUMA_ENABLED
+      "    --numa\n"
+      "      spread threads over NUMA nodes and interleave minimizer indices\n"
+#endif
+      "    --long-edges <string>\n"
+      "      default: layout\n"
+      "      how long edges at junctions are found: layout (edge lengths in\n"
+      "      force directed layout), neighbourhood (neighbours shared by edge\n"
+      "      ends, no layout) or compare (remove by layout and report the\n"
+      "      agreement with neighbourhood)\n"
       "    --graphical-fragment-assembly <string>\n"
       "      prints the assemblg graph in GFA format\n"
       "    --resume\n"
-      "      resume previous run from last checkpoint\n"
+      "      resume previous run from last checkpoint (checkpoints and shards\n"
+      "      stored by versions without a format tag are rejected)\n"
       "    -t, --threads <int>\n"
       "      default: 1\n"
       "      number of threads\n"
@@ -119,6 +201,22 @@ int main(int argc, char** argv) {
   std::int8_t m = 3;
   std::int8_t n = -5;
   std::int8_t g = -4;
+  std::uint64_t polishing_chunk_size = 0;
+
+  std::vector<double> k = {15};
+  std::vector<double> w = {5};
+  std::vector<double> frequency = {0.001, 0.001, 0.00001};
+  bool tune = false;
+  bool hpc = false;
+  double coverage = 0;
+
+  std::uint32_t num_shards = 0;
+  std::int32_t shard = -1;
+  std::uint32_t num_merged_shards = 0;
+
+  bool numa = false;
+
+  auto long_edges = raven::LongEdgeMode::kLayout;
 
   std::string gfa_path = "";
   bool resume = false;
@@ -129,7 +227,7 @@ int main(int argc, char** argv) {
   std::uint32_t cuda_alignment_batches = 0;
   bool cuda_banded_alignment = false;
 
-  std::string optstr = "p:m:n:g:t:h";
+  std::string optstr = "p:m:n:g:k:w:t:h";
 #ifdef CUDA_ENABLED
   optstr += "c:b:a:";
 #endif
@@ -140,6 +238,16 @@ int main(int argc, char** argv) {
       case 'm': m = atoi(optarg); break;
       case 'n': n = atoi(optarg); break;
       case 'g': g = atoi(optarg); break;
+      case 'P': {
+        auto values = ParseList(optarg);
+        if (values.size() != 1 || values[0] < 0) {
+          std::cerr << "[raven::] error: invalid polishing chunk size "
+                    << optarg << "!" << std::endl;
+          return 1;
+        }
+        polishing_chunk_size = static_cast<std::uint64_t>(values[0]) << 20;
+        break;
+      }
 #ifdef CUDA_ENABLED
       case 'c':
         cuda_poa_batches = 1;
@@ -159,6 +267,72 @@ int main(int argc, char** argv) {
         cuda_alignment_batches = atoi(optarg);
         break;
 #endif
+      case 'k': k = ParseList(optarg); break;
+      case 'w': w = ParseList(optarg); break;
+      case 'F': {
+        auto values = ParseList(optarg);
+        if (values.empty() || values.size() > frequency.size()) {
+          std::cerr << "[raven::] error: invalid frequency list "
+                    << optarg << "!" << std::endl;
+          return 1;
+        }
+        std::copy(values.begin(), values.end(), frequency.begin());
+        break;
+      }
+      case 'T': tune = true; break;
+      case 'H': hpc = true; break;
+      case 'C': {
+        auto values = ParseList(optarg);
+        if (values.size() != 1 || !(values[0] > 0)) {
+          std::cerr << "[raven::] error: invalid coverage " << optarg << "!"
+                    << std::endl;
+          return 1;
+        }
+        coverage = values[0];
+        break;
+      }
+      case 'S': {
+        auto values = ParseList(optarg);
+        if (values.size() != 2 ||
+            values[0] < 0 || values[0] != std::floor(values[0]) ||
+            values[1] < 1 || values[1] != std::floor(values[1])) {
+          std::cerr << "[raven::] error: invalid shard " << optarg << "!"
+                    << std::endl;
+          return 1;
+        }
+        shard = values[0];
+        num_shards = values[1];
+        break;
+      }
+      case 'M': {
+        auto values = ParseList(optarg);
+        if (values.size() != 1 ||
+            values[0] < 1 || values[0] != std::floor(values[0])) {
+          std::cerr << "[raven::] error: invalid number of shards " << optarg
+                    << "!" << std::endl;
+          return 1;
+        }
+        num_merged_shards = values[0];
+        break;
+      }
+#ifdef NUMA_ENABLED
+      case 'N': numa = true; break;
+#endif
+      case 'L': {
+        std::string mode = optarg;
+        if (mode == "layout") {
+          long_edges = raven::LongEdgeMode::kLayout;
+        } else if (mode == "neighbourhood") {
+          long_edges = raven::LongEdgeMode::kNeighbourhood;
+        } else if (mode == "compare") {
+          long_edges = raven::LongEdgeMode::kCompare;
+        } else {
+          std::cerr << "[raven::] error: unknown long edge mode " << mode
+                    << "!" << std::endl;
+          return 1;
+        }
+        break;
+      }
       case 'f': gfa_path = optarg; break;
       case 'r': resume = true; break;
       case 't': num_threads = atoi(optarg); break;
@@ -178,6 +352,41 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  if (shard >= 0 && num_merged_shards > 0) {
+    std::cerr << "[raven::] error: --shard and --merge-shards are exclusive!"
+              << std::endl;
+    return 1;
+  }
+  if (shard >= static_cast<std::int32_t>(num_shards)) {
+    std::cerr << "[raven::] error: invalid shard!" << std::endl;
+    return 1;
+  }
+  if (num_merged_shards > 0) {
+    num_shards = num_merged_shards;
+  }
+
+  if (k.empty() || k.size() > 2 || w.empty() || w.size() > 2) {
+    std::cerr << "[raven::] error: k-mer and window lengths take one or two "
+              << "integers!" << std::endl;
+    return 1;
+  }
+  k.resize(2, k.back());
+  w.resize(2, w.back());
+  for (const auto& it : k) {
+    if (it < 1 || it > 31) {
+      std::cerr << "[raven::] error: k-mer length must be in [1, 31]!"
+                << std::endl;
+      return 1;
+    }
+  }
+  for (const auto& it : w) {
+    if (it < 1) {
+      std::cerr << "[raven::] error: window length must be positive!"
+                << std::endl;
+      return 1;
+    }
+  }
+
   auto sparser = CreateParser(argv[optind]);
   if (sparser == nullptr) {
     return 1;
@@ -188,7 +397,17 @@ int main(int argc, char** argv) {
 
   auto thread_pool = std::make_shared<thread_pool::ThreadPool>(num_threads);
 
-  raven::Graph graph{thread_pool};
+  if (numa) {
+    auto num_nodes = raven::BindToNodes(thread_pool);
+
+    std::cerr << "[raven::] bound threads to " << num_nodes << " NUMA node(s) "
+              << std::fixed << timer.Stop() << "s"
+              << std::endl;
+
+    timer.Start();
+  }
+
+  raven::Graph graph{thread_pool, numa};
   if (resume) {
     try {
       graph.Load();
@@ -205,10 +424,20 @@ int main(int argc, char** argv) {
   }
 
   std::vector<std::unique_ptr<biosoup::Sequence>> sequences;
+  raven::QualityAccumulator quality;
   if ((graph.stage() < -3) ||
-      (graph.stage() >= 0 && graph.stage() < num_polishing_rounds)) {
+      (graph.stage() >= 0 && graph.stage() < num_polishing_rounds &&
+       polishing_chunk_size == 0)) {
     try {
-      sequences = sparser->Parse(-1);
+      while (true) {  // in chunks to drop uniform qualities early
+        auto chunk = sparser->Parse(1ULL << 28);
+        if (chunk.empty()) {
+          break;
+        }
+        std::uint32_t first = sequences.size();
+        std::move(chunk.begin(), chunk.end(), std::back_inserter(sequences));
+        quality.Update(&sequences, first, thread_pool);
+      }
     } catch (const std::invalid_argument& exception) {
       std::cerr << exception.what() << std::endl;
       return 1;
@@ -226,10 +455,42 @@ int main(int argc, char** argv) {
     timer.Start();
   }
 
-  graph.Construct(sequences);
-  graph.Assemble();
-  graph.Polish(sequences, m, n, g, cuda_poa_batches, cuda_banded_alignment,
-      cuda_alignment_batches, num_polishing_rounds);
+  graph.Construct(
+      sequences,
+      hpc,
+      raven::MinimizerParameters(k[0], w[0], frequency[0]),
+      raven::MinimizerParameters(k[1], w[1], frequency[1]),
+      frequency[2],
+      tune,
+      coverage,
+      num_shards,
+      shard);
+  if (shard >= 0) {
+    timer.Stop();
+    std::cerr << "[raven::] " << std::fixed << timer.elapsed_time() << "s"
+              << std::endl;
+    return 0;
+  }
+
+  if (polishing_chunk_size > 0) {  // reread while polishing
+    std::vector<std::unique_ptr<biosoup::Sequence>>().swap(sequences);
+  }
+
+  graph.Assemble(long_edges);
+  if (polishing_chunk_size > 0) {
+    try {  // sequences are parsed again and spilled while polishing
+      graph.Polish(sparser.get(), polishing_chunk_size, m, n, g,
+          cuda_poa_batches, cuda_banded_alignment, cuda_alignment_batches,
+          num_polishing_rounds);
+    } catch (const std::exception& exception) {
+      std::cerr << exception.what() << std::endl;
+      return 1;
+    }
+  } else {
+    graph.Polish(sequences, quality.is_uniform() ? 0. : quality.mean(),
+        m, n, g, cuda_poa_batches, cuda_banded_alignment,
+        cuda_alignment_batches, num_polishing_rounds);
+  }
   graph.PrintGFA(gfa_path);
 
   for (const auto& it : graph.GetUnitigs(num_polishing_rounds > 0)) {
@@ -16,6 +16,7 @@ Pile::Pile(std::uint32_t id, std::uint32_t len)
       is_contained_(0),
       is_chimeric_(0),
       is_repetitive_(0),
+      is_dropped_(0),
       data_(end_, 0),
       chimeric_regions_(),
       repetitive_regions_() {}
@@ -52,6 +53,12 @@ void Pile::AddLayers(
   }
 }
 
+void Pile::Merge(const Pile& other) {
+  for (std::uint32_t i = 0; i < data_.size() && i < other.data_.size(); ++i) {
+    data_[i] += other.data_[i];
+  }
+}
+
 void Pile::FindValidRegion(std::uint32_t coverage) {
   std::uint32_t begin = 0;
   std::uint32_t end = 0;
@@ -85,11 +85,22 @@ class Pile {
     is_repetitive_ = true;
   }
 
+  bool is_dropped() const {
+    return is_dropped_;
+  }
+
+  void set_is_dropped() {
+    is_dropped_ = true;
+  }
+
   // add coverage
   void AddLayers(
       std::vector<biosoup::Overlap>::const_iterator begin,
       std::vector<biosoup::Overlap>::const_iterator end);
 
+  // add coverage of another pile of the same sequence
+  void Merge(const Pile& other);
+
   // store longest region with values greater or equal than given coverage
   void FindValidRegion(std::uint32_t coverage);
 
@@ -136,6 +147,7 @@ class Pile {
         CEREAL_NVP(is_contained_),
         CEREAL_NVP(is_chimeric_),
         CEREAL_NVP(is_repetitive_),
+        CEREAL_NVP(is_dropped_),
         CEREAL_NVP(data_),
         CEREAL_NVP(chimeric_regions_),
         CEREAL_NVP(repetitive_regions_));
@@ -160,6 +172,7 @@ class Pile {
   bool is_contained_;
   bool is_chimeric_;
   bool is_repetitive_;
+  bool is_dropped_;  // left out by subsampling
   std::vector<std::uint32_t> data_;
   std::vector<Region> chimeric_regions_;
   std::vector<Region> repetitive_regions_;
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "quality.hpp"
+
+#include <algorithm>
+#include <future>
+#include <string>
+
+namespace raven {
+
+void QualityAccumulator::Update(
+    std::vector<std::unique_ptr<biosoup::Sequence>>* sequences,
+    std::uint32_t first,
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool) {
+
+  struct Statistics {
+    double sum;
+    std::int32_t min;
+    std::int32_t max;
+  };
+
+  const auto& src = *sequences;
+  std::vector<Statistics> statistics(src.size() - first, {0., -1, -1});
+
+  // plain integer loops over quality bytes are vectorized by the compiler
+  std::vector<std::future<void>> thread_futures;
+  for (std::uint32_t i = first; i < src.size(); i += 1024) {
+    thread_futures.emplace_back(thread_pool->Submit(
+        [&] (std::uint32_t begin, std::uint32_t end) -> void {
+          for (std::uint32_t j = begin; j < end; ++j) {
+            const auto& quality = src[j]->quality;
+            if (quality.empty()) {
+              continue;
+            }
+            auto data = reinterpret_cast<const std::uint8_t*>(quality.data());
+            std::uint64_t sum = 0;
+            std::uint8_t min = 255, max = 0;
+            for (std::uint32_t k = 0; k < quality.size(); ++k) {
+              sum += data[k];
+              min = std::min(min, data[k]);
+              max = std::max(max, data[k]);
+            }
+            statistics[j - first] = {
+                (sum - 33. * quality.size()) / quality.size(), min, max};
+          }
+        },
+        i, std::min(i + 1024, static_cast<std::uint32_t>(src.size()))));
+  }
+  for (const auto& it : thread_futures) {
+    it.wait();
+  }
+
+  bool is_uniform = is_uniform_;
+  for (const auto& it : statistics) {
+    if (it.min == -1) {  // without qualities
+      continue;
+    }
+    sum_ += it.sum;
+    ++num_sequences_;
+    if (value_ == -1) {
+      value_ = it.min;
+    }
+    if (it.min != value_ || it.max != value_) {
+      is_uniform_ = false;
+    }
+  }
+
+  if (is_uniform_) {
+    for (std::uint32_t i = first; i < src.size(); ++i) {
+      std::string().swap(src[i]->quality);
+    }
+  } else if (is_uniform && value_ != -1) {  // restore dropped qualities
+    for (std::uint32_t i = 0; i < first; ++i) {
+      src[i]->quality.assign(src[i]->data.size(), value_);
+    }
+  }
+}
+
+}  // namespace raven
@@ -0,0 +1,59 @@
+// Copyright (c) 2020 Robert Vaser
+
+#ifndef RAVEN_QUALITY_HPP_
+#define RAVEN_QUALITY_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "biosoup/sequence.hpp"
+#include "thread_pool/thread_pool.hpp"
+
+namespace raven {
+
+// average Phred quality of sequences gathered chunk by chunk while parsing,
+// qualities are dropped as long as all of them are absent or equal and are
+// restored once a chunk with different values arrives
+class QualityAccumulator {
+ public:
+  QualityAccumulator()
+      : sum_(0.),
+        num_sequences_(0),
+        value_(-1),
+        is_uniform_(true) {}
+
+  QualityAccumulator(const QualityAccumulator&) = default;
+  QualityAccumulator& operator=(const QualityAccumulator&) = default;
+
+  QualityAccumulator(QualityAccumulator&&) = default;
+  QualityAccumulator& operator=(QualityAccumulator&&) = default;
+
+  ~QualityAccumulator() = default;
+
+  // account sequences from first onwards (earlier ones are the ones passed
+  // to previous calls)
+  void Update(
+      std::vector<std::unique_ptr<biosoup::Sequence>>* sequences,
+      std::uint32_t first,
+      std::shared_ptr<thread_pool::ThreadPool> thread_pool);
+
+  // mean over sequences with qualities of their average Phred quality
+  double mean() const {
+    return num_sequences_ ? sum_ / num_sequences_ : 0.;
+  }
+
+  bool is_uniform() const {
+    return is_uniform_;
+  }
+
+ private:
+  double sum_;
+  std::uint64_t num_sequences_;  // with qualities
+  std::int32_t value_;  // of all qualities while uniform
+  bool is_uniform_;
+};
+
+}  // namespace raven
+
+#endif  // RAVEN_QUALITY_HPP_
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "flat_set.hpp"
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace raven {
+namespace test {
+
+TEST(FlatSetTest, Empty) {
+  FlatSet<std::uint32_t> s;
+  EXPECT_TRUE(s.empty());
+  EXPECT_EQ(0U, s.size());
+  EXPECT_EQ(s.begin(), s.end());
+  EXPECT_EQ(0U, s.count(0));
+}
+
+TEST(FlatSetTest, Emplace) {
+  FlatSet<std::uint32_t, 4> s;
+  EXPECT_TRUE(s.emplace(3));
+  EXPECT_TRUE(s.emplace(1));
+  EXPECT_FALSE(s.emplace(3));
+  EXPECT_TRUE(s.emplace(2));
+  EXPECT_EQ(3U, s.size());
+  EXPECT_EQ(std::vector<std::uint32_t>({1, 2, 3}),
+      std::vector<std::uint32_t>(s.begin(), s.end()));
+  EXPECT_EQ(1U, s.count(2));
+  EXPECT_EQ(0U, s.count(4));
+}
+
+TEST(FlatSetTest, Spill) {  // past inline capacity
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<std::uint32_t> distribution(0, 63);
+
+  FlatSet<std::uint32_t, 4> s;
+  std::set<std::uint32_t> expected;
+  for (std::uint32_t i = 0; i < 100; ++i) {
+    auto value = distribution(generator);
+    EXPECT_EQ(expected.emplace(value).second, s.emplace(value));
+    EXPECT_EQ(expected.size(), s.size());
+    EXPECT_EQ(std::vector<std::uint32_t>(expected.begin(), expected.end()),
+        std::vector<std::uint32_t>(s.begin(), s.end()));
+  }
+  for (std::uint32_t i = 0; i < 64; ++i) {
+    EXPECT_EQ(expected.count(i), s.count(i));
+  }
+}
+
+TEST(FlatSetTest, Clear) {
+  FlatSet<std::uint32_t, 4> s;
+  std::vector<std::uint32_t> values = {5, 4, 3, 2, 1, 0};
+  s.insert(values.begin(), values.end());
+  s.clear();
+  EXPECT_TRUE(s.empty());
+  EXPECT_EQ(0U, s.count(3));
+  EXPECT_TRUE(s.emplace(3));
+  EXPECT_EQ(1U, s.size());
+}
+
+TEST(FlatSetTest, Swap) {
+  FlatSet<std::uint32_t, 4> small;
+  FlatSet<std::uint32_t, 4> large;
+  std::vector<std::uint32_t> values = {5, 4, 3, 2, 1, 0};
+  small.insert(values.begin(), values.begin() + 2);
+  large.insert(values.begin(), values.end());
+
+  small.swap(large);
+  EXPECT_EQ(std::vector<std::uint32_t>({0, 1, 2, 3, 4, 5}),
+      std::vector<std::uint32_t>(small.begin(), small.end()));
+  EXPECT_EQ(std::vector<std::uint32_t>({4, 5}),
+      std::vector<std::uint32_t>(large.begin(), large.end()));
+}
+
+}  // namespace test
+}  // namespace raven
@@ -0,0 +1,393 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "graph.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+std::atomic<std::uint32_t> biosoup::Sequence::num_objects{0};
+
+namespace raven {
+namespace test {
+
+class GraphTest: public ::testing::Test {
+ public:
+  void TearDown() override {
+    std::remove("raven.cereal");
+  }
+
+  static std::uint32_t ShardBoundary(
+      const std::vector<std::uint64_t>& num_bytes,
+      std::uint32_t shard,
+      std::uint32_t num_shards) {
+    return Graph::ShardBoundary(num_bytes, shard, num_shards);
+  }
+
+  std::uint64_t EstimateGenomeSize(
+      const std::vector<std::unique_ptr<biosoup::Sequence>>& sequences) {
+    return graph.EstimateGenomeSize(sequences);
+  }
+
+  // node pair of given sequence count, returns id of the forward node
+  std::uint32_t AddNode(
+      std::uint32_t count,
+      const std::string& data = std::string(1000, 'A')) {
+    biosoup::Sequence sequence("", data);
+    auto id = graph.AddNode(sequence);
+    graph.nodes_[id].count = graph.nodes_[id + 1].count = count;
+    return id;
+  }
+
+  // edge pair of given length, returns id of the forward edge
+  std::uint32_t AddEdge(
+      std::uint32_t tail,
+      std::uint32_t head,
+      std::uint32_t length = 500) {
+    return graph.AddEdge(tail, head, length, length);
+  }
+
+  // forward edges marked as removed, checking that their pairs are too
+  std::vector<std::uint32_t> RemovedEdges() const {
+    std::vector<std::uint32_t> dst;
+    for (const auto& it : graph.edges_) {
+      EXPECT_EQ(it.is_removed, graph.edges_[it.pair].is_removed);
+      if (!it.is_rc() && it.is_removed) {
+        dst.emplace_back(it.id);
+      }
+    }
+    return dst;
+  }
+
+  bool IsRemoved(std::uint32_t node) const {
+    return graph.nodes_[node].is_removed;
+  }
+
+  bool IsTransitive(std::uint32_t lhs, std::uint32_t rhs) const {
+    return graph.nodes_[lhs].transitive.count(rhs) == 1;
+  }
+
+  std::uint32_t RemoveTransitiveEdges() {
+    return graph.RemoveTransitiveEdges();
+  }
+
+  std::uint32_t RemoveTips() {
+    return graph.RemoveTips();
+  }
+
+  std::uint32_t RemoveBubbles() {
+    return graph.RemoveBubbles();
+  }
+
+  bool IsBubble(
+      const std::vector<std::uint32_t>& lhs,
+      const std::vector<std::uint32_t>& rhs) {
+    return graph.IsBubble(lhs, rhs);
+  }
+
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> FindSuperbubbles() const {  // NOLINT
+    return graph.FindSuperbubbles();
+  }
+
+  std::uint32_t RemoveSuperbubbles(
+      const std::vector<std::pair<std::uint32_t, std::uint32_t>>& superbubbles) {  // NOLINT
+    return graph.RemoveSuperbubbles(superbubbles);
+  }
+
+  std::uint32_t RemoveTipsAndBubbles() {
+    return graph.RemoveTipsAndBubbles();
+  }
+
+  // reads of given length sampled uniformly from both strands of a random
+  // genome, each base is substituted with given probability
+  static std::vector<std::unique_ptr<biosoup::Sequence>> Simulate(
+      std::uint32_t genome_len,
+      std::uint32_t read_len,
+      double coverage,
+      double error_rate,
+      std::string* genome_ptr = nullptr) {
+    biosoup::Sequence::num_objects = 0;  // ids index piles
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<std::uint32_t> base(0, 3);
+    std::string genome;
+    for (std::uint32_t i = 0; i < genome_len; ++i) {
+      genome += "ACGT"[base(generator)];
+    }
+
+    std::uniform_int_distribution<std::uint32_t> begin(
+        0, genome_len - read_len);
+    std::uniform_real_distribution<double> error(0, 1);
+    std::vector<std::unique_ptr<biosoup::Sequence>> dst;
+    for (std::uint32_t i = 0; i < coverage * genome_len / read_len; ++i) {
+      std::string data = genome.substr(begin(generator), read_len);
+      for (auto& it : data) {
+        if (error(generator) < error_rate) {
+          it = "ACGT"[(std::string("ACGT").find(it) + 1 + base(generator) % 3) % 4];  // NOLINT
+        }
+      }
+      dst.emplace_back(new biosoup::Sequence(
+          "read" + std::to_string(i), data));
+      if (i & 1) {
+        dst.back()->ReverseAndComplement();
+      }
+    }
+    if (genome_ptr) {
+      genome_ptr->swap(genome);
+    }
+    return dst;
+  }
+
+  static std::vector<std::unique_ptr<biosoup::Sequence>> Assemble(
+      std::vector<std::unique_ptr<biosoup::Sequence>>& sequences,  // NOLINT
+      std::uint32_t num_threads) {
+    Graph graph(std::make_shared<thread_pool::ThreadPool>(num_threads));
+    graph.Construct(sequences);
+    graph.Assemble();
+    return graph.GetUnitigs();
+  }
+
+  Graph graph{std::make_shared<thread_pool::ThreadPool>(4)};
+};
+
+TEST_F(GraphTest, ShardsCoverSequences) {
+  std::mt19937 generator(21);
+  std::uniform_int_distribution<std::uint32_t> distribution(1000, 20000);
+  std::vector<std::uint64_t> num_bytes(1, 0);
+  for (std::uint32_t i = 0; i < 1000; ++i) {
+    num_bytes.emplace_back(num_bytes.back() + distribution(generator));
+  }
+
+  for (std::uint32_t num_shards : {1, 2, 3, 7, 16}) {
+    EXPECT_EQ(0U, ShardBoundary(num_bytes, 0, num_shards));
+    for (std::uint32_t i = 0; i < num_shards; ++i) {
+      EXPECT_LE(
+          ShardBoundary(num_bytes, i, num_shards),
+          ShardBoundary(num_bytes, i + 1, num_shards));
+    }
+    EXPECT_EQ(1000U, ShardBoundary(num_bytes, num_shards, num_shards));
+  }
+}
+
+TEST_F(GraphTest, ShardsSplitWorkEvenly) {
+  std::vector<std::uint64_t> num_bytes(1, 0);
+  for (std::uint32_t i = 0; i < 1000; ++i) {
+    num_bytes.emplace_back(num_bytes.back() + 1000);
+  }
+
+  // sequence i is mapped onto the i + 1 indexed ones
+  double num_mappings = 1000. * 1001. / 2.;
+  for (std::uint32_t num_shards : {2, 4, 8}) {
+    for (std::uint32_t i = 0; i < num_shards; ++i) {
+      std::uint64_t first = ShardBoundary(num_bytes, i, num_shards);
+      std::uint64_t last = ShardBoundary(num_bytes, i + 1, num_shards);
+      double work = (last * (last + 1) - first * (first + 1)) / 2.;
+      EXPECT_NEAR(num_mappings / num_shards, work,
+          0.02 * num_mappings / num_shards);
+    }
+  }
+}
+
+TEST_F(GraphTest, EstimateGenomeSize) {
+  auto sequences = Simulate(500000, 5000, 20, 0);
+  EXPECT_NEAR(500000, EstimateGenomeSize(sequences), 50000);
+}
+
+TEST_F(GraphTest, EstimateGenomeSizeIgnoresErrors) {
+  auto sequences = Simulate(500000, 5000, 20, 0.01);
+  EXPECT_NEAR(500000, EstimateGenomeSize(sequences), 50000);
+}
+
+TEST_F(GraphTest, RemoveTransitiveEdges) {
+  auto a = AddNode(6);
+  auto b = AddNode(6);
+  auto c = AddNode(6);
+  auto d = AddNode(6);
+  AddEdge(a, b);
+  AddEdge(b, c);
+  auto ac = AddEdge(a, c, 1000);
+  AddEdge(c, d);
+  AddEdge(b, d, 2000);  // longer than the path over c
+
+  EXPECT_EQ(1U, RemoveTransitiveEdges());
+  EXPECT_EQ(std::vector<std::uint32_t>({ac}), RemovedEdges());
+  EXPECT_TRUE(IsTransitive(a, c));
+  EXPECT_TRUE(IsTransitive(c, a));
+}
+
+TEST_F(GraphTest, RemoveTips) {
+  auto a = AddNode(6);
+  auto b = AddNode(6);
+  auto c = AddNode(6);
+  auto t = AddNode(1);
+  AddEdge(a, b);
+  AddEdge(b, c);
+  auto tb = AddEdge(t, b);
+
+  EXPECT_EQ(1U, RemoveTips());
+  EXPECT_EQ(std::vector<std::uint32_t>({tb}), RemovedEdges());
+  EXPECT_TRUE(IsRemoved(t));
+  EXPECT_FALSE(IsRemoved(b));
+}
+
+TEST_F(GraphTest, RemoveTipsReplay) {  // tips found in parallel
+  auto t = AddNode(1);
+  auto u = AddNode(1);
+  auto b = AddNode(6);
+  auto c = AddNode(6);
+  auto tb = AddEdge(t, b);
+  AddEdge(u, b);
+  AddEdge(b, c);
+
+  // once t is removed, u continues over b and is no longer a tip
+  EXPECT_EQ(1U, RemoveTips());
+  EXPECT_EQ(std::vector<std::uint32_t>({tb}), RemovedEdges());
+  EXPECT_TRUE(IsRemoved(t));
+  EXPECT_FALSE(IsRemoved(u));
+}
+
+TEST_F(GraphTest, RemoveBubbles) {
+  auto s = AddNode(6);
+  auto x = AddNode(1);
+  auto y = AddNode(6);
+  auto e = AddNode(6);
+  auto sx = AddEdge(s, x);
+  AddEdge(s, y);
+  auto xe = AddEdge(x, e);
+  AddEdge(y, e);
+
+  EXPECT_EQ(1U, RemoveBubbles());
+  EXPECT_EQ(std::vector<std::uint32_t>({sx, xe}), RemovedEdges());
+  EXPECT_TRUE(IsRemoved(x));
+  EXPECT_FALSE(IsRemoved(y));
+}
+
+TEST_F(GraphTest, IsBubbleWithBranches) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<std::uint32_t> base(0, 3);
+  auto random = [&] (std::uint32_t len) -> std::string {
+    std::string dst;
+    for (std::uint32_t i = 0; i < len; ++i) {
+      dst += "ACGT"[base(generator)];
+    }
+    return dst;
+  };
+  auto mutate = [&] (std::string data) -> std::string {  // every 50th base
+    for (std::uint32_t i = 0; i < data.size(); i += 50) {
+      data[i] = data[i] == 'A' ? 'C' : 'A';
+    }
+    return data;
+  };
+
+  // paths spell 6 kbp, a quarter of which is shared, branches over
+  // junctions y and z (edges to w)
+  auto genome = random(6000);
+  auto s = AddNode(6, genome.substr(0, 1000));
+  auto x = AddNode(6, genome.substr(500, 5000));
+  auto y = AddNode(6, mutate(genome.substr(500, 5000)));
+  auto z = AddNode(6, random(5000));
+  auto e = AddNode(6, genome.substr(5000));
+  auto w = AddNode(6);
+  for (auto it : {x, y, z}) {
+    AddEdge(s, it);
+    AddEdge(it, e, 4500);
+  }
+  AddEdge(y, w);
+  AddEdge(z, w);
+
+  EXPECT_TRUE(IsBubble({s, x, e}, {s, y, e}));
+  EXPECT_FALSE(IsBubble({s, x, e}, {s, z, e}));
+  EXPECT_FALSE(IsBubble({s, y, e}, {s, z, e}));
+}
+
+TEST_F(GraphTest, RemoveSuperbubbles) {
+  auto s = AddNode(6);
+  auto p = AddNode(6);
+  auto q = AddNode(1);
+  auto r = AddNode(6);
+  auto z = AddNode(1);
+  auto e = AddNode(6);
+  auto w = AddNode(6);
+  AddEdge(s, p);
+  auto pq = AddEdge(p, q);
+  AddEdge(p, w);
+  auto qr = AddEdge(q, r);
+  AddEdge(w, r);
+  AddEdge(r, e);
+  auto sz = AddEdge(s, z);
+  auto ze = AddEdge(z, e);
+
+  auto superbubbles = FindSuperbubbles();
+  auto inner = std::find(superbubbles.begin(), superbubbles.end(),
+      std::make_pair(p, r));
+  auto outer = std::find(superbubbles.begin(), superbubbles.end(),
+      std::make_pair(s, e));
+  ASSERT_NE(superbubbles.end(), inner);
+  ASSERT_NE(superbubbles.end(), outer);
+  EXPECT_LT(inner, outer);
+
+  EXPECT_EQ(2U, RemoveSuperbubbles(superbubbles));
+  EXPECT_EQ(std::vector<std::uint32_t>({pq, qr, sz, ze}), RemovedEdges());
+  EXPECT_TRUE(IsRemoved(q));
+  EXPECT_TRUE(IsRemoved(z));
+}
+
+TEST_F(GraphTest, RemoveTipsAndBubbles) {  // bubble with a tip on a branch
+  auto s = AddNode(6);
+  auto x = AddNode(1);
+  auto y = AddNode(6);
+  auto e = AddNode(6);
+  auto t = AddNode(1);
+  auto sx = AddEdge(s, x);
+  AddEdge(s, y);
+  auto xe = AddEdge(x, e);
+  AddEdge(y, e);
+  auto tx = AddEdge(t, x);
+
+  EXPECT_EQ(2U, RemoveTipsAndBubbles());
+  EXPECT_EQ(std::vector<std::uint32_t>({sx, xe, tx}), RemovedEdges());
+  EXPECT_TRUE(IsRemoved(t));
+  EXPECT_TRUE(IsRemoved(x));
+}
+
+TEST_F(GraphTest, UnitigsSpellGenome) {
+  std::string genome;
+  auto sequences = Simulate(100000, 10000, 20, 0, &genome);
+  auto unitigs = Assemble(sequences, 4);
+  ASSERT_FALSE(unitigs.empty());
+
+  biosoup::Sequence rc("", genome);
+  rc.ReverseAndComplement();
+  std::uint64_t num_bytes = 0;
+  for (const auto& it : unitigs) {
+    EXPECT_TRUE(
+        genome.find(it->data) != std::string::npos ||
+        rc.data.find(it->data) != std::string::npos);
+    num_bytes = std::max(num_bytes, static_cast<std::uint64_t>(it->data.size()));  // NOLINT
+  }
+  EXPECT_LT(0.9 * genome.size(), num_bytes);
+}
+
+TEST_F(GraphTest, UnitigsIndependentOfThreads) {
+  auto sequences = Simulate(100000, 10000, 20, 0.01);
+  auto expected = Assemble(sequences, 1);
+
+  sequences = Simulate(100000, 10000, 20, 0.01);
+  auto unitigs = Assemble(sequences, 4);
+
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(expected.size(), unitigs.size());
+  for (std::uint32_t i = 0; i < unitigs.size(); ++i) {
+    EXPECT_EQ(expected[i]->name, unitigs[i]->name);
+    EXPECT_EQ(expected[i]->data, unitigs[i]->data);
+  }
+}
+
+}  // namespace test
+}  // namespace raven
@@ -0,0 +1,91 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "homopolymer.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace raven {
+namespace test {
+
+class HomopolymerTest: public ::testing::Test {
+ public:
+  // sequence of num_runs homopolymers of random length, starts of runs are
+  // stored with the sequence length appended
+  void Add(std::uint32_t num_runs) {
+    std::mt19937 generator(num_runs);
+    std::uniform_int_distribution<std::uint32_t> base(0, 3);
+    std::uniform_int_distribution<std::uint32_t> length(1, 5);
+
+    std::string data;
+    runs.resize(runs.size() + 1);
+    for (std::uint32_t i = 0; i < num_runs; ++i) {
+      char c;
+      do {
+        c = "ACGT"[base(generator)];
+      } while (!data.empty() && data.back() == c);
+      runs.back().emplace_back(data.size());
+      data += std::string(length(generator), c);
+    }
+    runs.back().emplace_back(data.size());
+
+    sequences.emplace_back(new biosoup::Sequence(
+        "seq" + std::to_string(sequences.size()), data));
+  }
+
+  void SetUp() override {
+    biosoup::Sequence::num_objects = 0;
+  }
+
+  std::shared_ptr<thread_pool::ThreadPool> thread_pool{
+      std::make_shared<thread_pool::ThreadPool>(2)};
+  std::vector<std::unique_ptr<biosoup::Sequence>> sequences;
+  std::vector<std::vector<std::uint32_t>> runs;
+  HomopolymerCompressor compressor;
+};
+
+TEST_F(HomopolymerTest, Compress) {
+  Add(100);
+  Add(64);  // ends on a sample
+  Add(1);
+  auto compressed = compressor.Compress(sequences, thread_pool);
+
+  ASSERT_EQ(sequences.size(), compressed.size());
+  for (std::uint32_t i = 0; i < compressed.size(); ++i) {
+    EXPECT_EQ(sequences[i]->id, compressed[i]->id);
+    EXPECT_EQ(sequences[i]->name, compressed[i]->name);
+
+    std::string data;
+    for (std::uint32_t j = 0; j + 1 < runs[i].size(); ++j) {
+      data += sequences[i]->data[runs[i][j]];
+    }
+    EXPECT_EQ(data, compressed[i]->data);
+  }
+}
+
+TEST_F(HomopolymerTest, Decompress) {
+  Add(100);
+  Add(64);  // ends on a sample
+  Add(17);
+  auto compressed = compressor.Compress(sequences, thread_pool);
+
+  // every compressed position, including sample boundaries (every 2 ^ kHSS
+  // bases), the last partial block and the end
+  for (std::uint32_t i = 0; i < compressed.size(); ++i) {
+    std::uint32_t n = compressed[i]->data.size();
+    for (std::uint32_t j = 0; j <= n; ++j) {
+      biosoup::Overlap o(i, j, n, i, 0, n - j, 0);
+      compressor.Decompress(o);
+      EXPECT_EQ(runs[i][j], o.lhs_begin);
+      EXPECT_EQ(runs[i][n], o.lhs_end);
+      EXPECT_EQ(runs[i][0], o.rhs_begin);
+      EXPECT_EQ(runs[i][n - j], o.rhs_end);
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace raven
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "pile.hpp"
+
+#include <vector>
+
+#include "biosoup/overlap.hpp"
+#include "gtest/gtest.h"
+
+namespace raven {
+namespace test {
+
+class PileTest: public ::testing::Test {
+ public:
+  void SetUp() override {
+    for (std::uint32_t i = 0; i < 12; ++i) {  // coverage of up to 8
+      overlaps.emplace_back(0, 500 * i, 4000 + 500 * i, i + 1, 0, 4000, 4000);
+    }
+  }
+
+  static void Annotate(Pile* pile) {
+    pile->FindValidRegion(4);
+    pile->FindMedian();
+  }
+
+  std::vector<biosoup::Overlap> overlaps;
+};
+
+TEST_F(PileTest, MergeEqualsAddLayers) {
+  Pile whole(0, 10000);
+  whole.AddLayers(overlaps.begin(), overlaps.end());
+  Annotate(&whole);
+  EXPECT_FALSE(whole.is_invalid());
+
+  Pile lhs(0, 10000);
+  lhs.AddLayers(overlaps.begin(), overlaps.begin() + 5);
+  Pile rhs(0, 10000);
+  rhs.AddLayers(overlaps.begin() + 5, overlaps.end());
+  lhs.Merge(rhs);
+  Annotate(&lhs);
+
+  EXPECT_FALSE(lhs.is_invalid());
+  EXPECT_EQ(whole.begin(), lhs.begin());
+  EXPECT_EQ(whole.end(), lhs.end());
+  EXPECT_EQ(whole.median(), lhs.median());
+}
+
+TEST_F(PileTest, MergeEmpty) {
+  Pile whole(0, 10000);
+  whole.AddLayers(overlaps.begin(), overlaps.end());
+  whole.Merge(Pile(0, 10000));
+  Annotate(&whole);
+
+  Pile expected(0, 10000);
+  expected.AddLayers(overlaps.begin(), overlaps.end());
+  Annotate(&expected);
+
+  EXPECT_EQ(expected.begin(), whole.begin());
+  EXPECT_EQ(expected.end(), whole.end());
+  EXPECT_EQ(expected.median(), whole.median());
+}
+
+TEST_F(PileTest, MergeLowCoverage) {
+  Pile lhs(0, 10000);
+  lhs.AddLayers(overlaps.begin(), overlaps.begin() + 2);
+  Annotate(&lhs);
+  EXPECT_TRUE(lhs.is_invalid());
+
+  Pile merged(0, 10000);
+  merged.AddLayers(overlaps.begin(), overlaps.begin() + 2);
+  Pile rhs(0, 10000);
+  rhs.AddLayers(overlaps.begin() + 2, overlaps.end());
+  merged.Merge(rhs);
+  Annotate(&merged);
+  EXPECT_FALSE(merged.is_invalid());
+}
+
+}  // namespace test
+}  // namespace raven
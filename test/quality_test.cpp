@@ -0,0 +1,85 @@
+// Copyright (c) 2020 Robert Vaser
+
+#include "quality.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace raven {
+namespace test {
+
+class QualityTest: public ::testing::Test {
+ public:
+  void Add(const std::string& quality) {
+    sequences.emplace_back(quality.empty() ?
+        new biosoup::Sequence("", std::string(4, 'A')) :
+        new biosoup::Sequence("", std::string(4, 'A'), quality));
+  }
+
+  void Update() {
+    accumulator.Update(&sequences, first, thread_pool);
+    first = sequences.size();
+  }
+
+  std::shared_ptr<thread_pool::ThreadPool> thread_pool{
+      std::make_shared<thread_pool::ThreadPool>(2)};
+  std::vector<std::unique_ptr<biosoup::Sequence>> sequences;
+  std::uint32_t first = 0;
+  QualityAccumulator accumulator;
+};
+
+TEST_F(QualityTest, DropUniform) {
+  Add("++++");
+  Add("++++");
+  Update();
+  Add("++++");
+  Update();
+
+  EXPECT_TRUE(accumulator.is_uniform());
+  EXPECT_DOUBLE_EQ(10., accumulator.mean());
+  for (const auto& it : sequences) {
+    EXPECT_TRUE(it->quality.empty());
+  }
+}
+
+TEST_F(QualityTest, RestoreUniform) {
+  Add("++++");
+  Add("++++");
+  Update();
+  Add("5555");
+  Update();
+
+  EXPECT_FALSE(accumulator.is_uniform());
+  EXPECT_DOUBLE_EQ(40. / 3., accumulator.mean());
+  EXPECT_EQ("++++", sequences[0]->quality);
+  EXPECT_EQ("++++", sequences[1]->quality);
+  EXPECT_EQ("5555", sequences[2]->quality);
+}
+
+TEST_F(QualityTest, RestoreWithoutQualities) {
+  Add("");
+  Add("++++");
+  Update();
+  Add("");
+  Add("+5+5");
+  Update();
+
+  EXPECT_FALSE(accumulator.is_uniform());
+  EXPECT_DOUBLE_EQ(12.5, accumulator.mean());  // records with qualities
+  EXPECT_EQ("++++", sequences[1]->quality);
+  EXPECT_EQ("+5+5", sequences[3]->quality);
+}
+
+TEST_F(QualityTest, WithoutQualities) {
+  Add("");
+  Update();
+
+  EXPECT_TRUE(accumulator.is_uniform());
+  EXPECT_DOUBLE_EQ(0., accumulator.mean());
+}
+
+}  // namespace test
+}  // namespace raven